@@ -1 +1 @@
-g++ -ggdb `pkg-config --cflags opencv4` -o `basename solver.cpp .cpp` ./src/solver.cpp ./src/MST_solver.cpp ./src/GA_solver.cpp `pkg-config --libs opencv4`
+g++ -ggdb -pthread `pkg-config --cflags opencv4` -o `basename solver.cpp .cpp` ./src/solver.cpp ./src/MST_solver.cpp ./src/GA_solver.cpp ./src/refine.cpp ./src/hierarchical.cpp ./src/session.cpp ./src/exact.cpp `pkg-config --libs opencv4`
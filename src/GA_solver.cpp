@@ -1,53 +1,80 @@
 #include "GA_solver.h"
+#include <atomic>
+#include <thread>
+#include <unordered_set>
 
-int GA::findbuddy(vector<Block> &c, bool * used, int k) {
+// The piece, turned to fit, that is the best buddy of a placed neighbour
+// of slot k on the side facing k; idx is -1 if there is none
+Block GA::findbuddy(vector<Block> &c, const vector<char> &used, int k) {
     int a = k / N, bb = k % N;
 
     // Directions: right, down, left, up
     int dx[4] = {0, 1, 0, -1};
     int dy[4] = {1, 0, -1, 0};
+    int dir[4] = {R, D, L, T};
 
     for (int i = 0; i < 4; i++) {
         int a1 = a + dx[i], b1 = bb + dy[i];
         if (a1 < 0 || a1 >= N || b1 < 0 || b1 >= N) continue;
 
-        if (c[a1 * N + b1].idx == -1) continue;
-
-        int l = -1;
-        // Select the correct buddy list based on the direction
-        switch(i) {
-            case 0: // Right
-                l = bbr[c[a1 * N + b1].idx];
-                break;
-            case 1: // Down
-                l = bbd[c[a1 * N + b1].idx];
-                break;
-            case 2: // Left
-                l = bbl[c[a1 * N + b1].idx];
-                break;
-            case 3: // Up
-                l = bbt[c[a1 * N + b1].idx];
-                break;
-        }
+        Block &nb = c[a1 * N + b1];
+        if (nb.idx == -1) continue;
 
-        if (l != -1 && !used[l]) return l;
+        // The buddy on the neighbour's facing side belongs in slot k
+        int v = buddy[4 * nb.idx + turnedSide(3 - dir[i], nb.rot)];
+        if (v != -1 && !used[v / 4]) return pieces->turned(v / 4, turnFor(dir[i], v % 4));
     }
 
-    return -1;
+    return Block();
 }
 
-vector<Block> GA::crossover(vector<Block> &a, vector<Block> &b)
+// Zobrist key of a piece, as turned, in a slot. The keys are mixed from
+// the triple on demand rather than drawn into an X*X table up front.
+// Interchangeable pieces hash alike, so layouts that only swap them are
+// one layout to the GA.
+uint64_t GA::zobrist(int slot, const Block &b)
 {
-  bool* vis = new bool[X];
-  bool* used = new bool[X];
-  queue<int> boundary;
-  vector<Block> ans(X);
-  for(int i=0;i<X;i++)
+  return Stream::mix(((uint64_t)slot<<34)^((uint64_t)pieces->symbolOf(b.idx)<<2)^(uint64_t)b.rot);
+}
+
+uint64_t GA::hashOf(vector<Block> &c)
+{
+  uint64_t key=0;
+  for(int i=0;i<X;i++) key^=zobrist(i,c[i]);
+  return key;
+}
+
+// Fitness through a direct-mapped cache keyed by the Zobrist hash; a
+// colliding entry is simply overwritten
+double GA::cachedFitness(vector<Block> &c, uint64_t key)
+{
+  pair<uint64_t,double> &slot=fitCache[key&(FITNESS_CACHE_SLOTS-1)];
+  if(slot.first==key&&key!=0) return slot.second;
+  slot=make_pair(key,fitness(c));
+  return slot.second;
+}
+
+vector<Block> GA::randomLayout(Stream &rng)
+{
+  vector<Block> temp;
+  for(int j=0;j<X;j++)
+    temp.pb(pieces->turned(j,pieces->rotations?rng.below(4):0));
+  for(int j=0;j<X;j++)
   {
-    vis[i]=0;
-    used[i]=0;
-    ans[i].idx=-1;
+    int rnd;
+    rnd=rng.below(X);
+    swap(temp[j],temp[rnd]);
   }
+  return temp;
+}
+
+// key is set to the child's Zobrist hash, built up as the slots fill
+vector<Block> GA::crossover(vector<Block> &a, vector<Block> &b, uint64_t &key, Stream &rng)
+{
+  vector<char> vis(X,0),used(X,0);
+  queue<int> boundary;
+  vector<Block> ans(X);
+  key=0;
 
   for(int i=0;i<X;i++)
   {
@@ -60,42 +87,42 @@ vector<Block> GA::crossover(vector<Block> &a, vector<Block> &b)
   }
 
   double ma;
-  int ind;
 
-  if(boundary.size()==0) boundary.push(rand()%X);
+  if(boundary.size()==0) boundary.push(rng.below(X));
 
   vis[boundary.front()]=1;
 
   while(boundary.size())
   {
     int temp=boundary.front();
-    int k;
     boundary.pop();
-    if(a[temp].idx==b[temp].idx&&!used[a[temp].idx])
+    Block k;
+    if(a[temp].idx==b[temp].idx&&a[temp].rot==b[temp].rot&&!used[a[temp].idx])
     {
-      ind=a[temp].idx;
-      k=ind;
+      k=a[temp];
     }
-    else if((k=findbuddy(ans,used,temp))!=-1)
+    else if((k=findbuddy(ans,used,temp)).idx!=-1)
     {
 
     }
     else
     {
-      ind=-1;
       for(int i=0;i<X;i++)
       {
         if(!used[i])
         {
-          double matemp=pieces->getWeight(ans,temp,pieces->block[i]);
-          if(ind==-1||ma>matemp) ind=i,ma=matemp;
+          for(int r=0;r<pieces->turns();r++)
+          {
+            double matemp=pieces->getWeight(ans,temp,pieces->turned(i,r),k.idx==-1?HUGE_VAL:ma);
+            if(k.idx==-1||ma>matemp) k=pieces->turned(i,r),ma=matemp;
+          }
         }
-        k=ind;
       }
     }
 
-    used[k]=1;
-    ans[temp]=pieces->block[k];
+    used[k.idx]=1;
+    ans[temp]=k;
+    key^=zobrist(temp,k);
     int aa,bb;
     bb=temp%N;
     aa=temp/N;
@@ -129,59 +156,112 @@ vector<Block> GA::crossover(vector<Block> &a, vector<Block> &b)
 
 double GA::fitness(vector<Block> &c)
 {
-double ans=0;
-for(int i=0;i<X;i++)
-{
-  if((i+1)%N==0){}
-    else
-    {
-      ans+=pieces->adjr[c[i].idx][c[i+1].idx];
-    }
-  }
-  for(int i=0;i<X-N;i++)
-  {
-    ans+=pieces->adjd[c[i].idx][c[i+N].idx];
-  }
-  return ans;
+  return pieces->layoutCost(c);
 }
 
-vector<vector<Block> > GA::bestGen(vector<vector<Block> > &gen)
+// keys holds the hash of each member of gen and is replaced by those of
+// the elites returned
+vector<vector<Block> > GA::bestGen(vector<vector<Block> > &gen, vector<uint64_t> &keys)
 {
   priority_queue<Data> minque;
   vector<vector<Block> > answer;
+  vector<uint64_t> answerKeys;
   for(int i=0;i<gen.size();i++)
   {
     double wt=0;
-    wt = fitness(gen[i]);
+    wt = cachedFitness(gen[i],keys[i]);
     Data temp;
     temp.wt=wt;
     temp.ind = i;
     minque.push(temp);
-    if(minque.size() > 4)
+    if(minque.size() > elites)
       minque.pop();
   }
   while(minque.size())
   {
     answer.pb(gen[minque.top().ind]);
+    answerKeys.pb(keys[minque.top().ind]);
     minque.pop();
   }
+  // Fittest first
+  reverse(answer.begin(),answer.end());
+  reverse(answerKeys.begin(),answerKeys.end());
+  keys.swap(answerKeys);
   return answer;
 }
 
-vector<vector<Block> > GA::generation(vector<vector<Block> > &gen,int height,int width)
+// Children are bred in batches of CHILD_BATCH, whose parents are drawn
+// from the elites and every earlier batch. Within a batch the children
+// are bred in parallel, child c of generation g from its own stream, and
+// checked for duplicates afterwards in child order, so the result does
+// not depend on the thread count. A child that is already in the new
+// generation is not evaluated twice: random pairs of its slots are
+// swapped until it is new, or it is replaced by a random layout, or left
+// out. Crossing two near-identical elites again would mostly repeat the
+// same work.
+vector<vector<Block> > GA::generation(vector<vector<Block> > &gen, vector<uint64_t> &keys, int g)
 {
   vector<vector<Block> > answer;
-  answer = bestGen(gen);
+  answer = bestGen(gen,keys);
+  unordered_set<uint64_t> seen(keys.begin(),keys.end());
 
-  while(answer.size()<1000)
+  reseeded=0;
+  int threads=max(1u,thread::hardware_concurrency());
+  while(answer.size()<population)
   {
-    int r1=0,r2=0;
-    while(r1==r2)
+    int first=answer.size();
+    vector<vector<Block> > child(min(CHILD_BATCH,population-first));
+    vector<uint64_t> childKey(child.size());
+    vector<Stream> rng;
+    for(int i=0;i<child.size();i++) rng.pb(Stream(seed,g,first+i));
+    atomic<int> next(0);
+    auto worker = [&]() {
+      for(int i=next++;i<child.size();i=next++)
+      {
+        int r1=0,r2=0;
+        while(r1==r2)
+        {
+          r1=rng[i].below(first);
+          r2=rng[i].below(first);
+        }
+        child[i]=crossover(answer[r1],answer[r2],childKey[i],rng[i]);
+      }
+    };
+    vector<thread> pool;
+    for(int i=1;i<min(threads,(int)child.size());i++) pool.pb(thread(worker));
+    worker();
+    for(int i=0;i<pool.size();i++) pool[i].join();
+
+    for(int i=0;i<child.size();i++)
     {
-      r1=rand()%(int)answer.size();
-      r2=rand()%(int)answer.size();
+      uint64_t key=childKey[i];
+      if(seen.count(key))
+      {
+        // Swaps of interchangeable pieces change nothing, so give up
+        // after a while if little else is left
+        for(int tries=0;seen.count(key)&&tries<MAX_RESEED_SWAPS;tries++)
+        {
+          int x=rng[i].below(X), y=rng[i].below(X);
+          key^=zobrist(x,child[i][x])^zobrist(y,child[i][y]);
+          swap(child[i][x],child[i][y]);
+          key^=zobrist(x,child[i][x])^zobrist(y,child[i][y]);
+        }
+        // Still there: start over from random layouts, and drop the child
+        // if even those are taken
+        for(int tries=0;seen.count(key)&&tries<MAX_RESEED_LAYOUTS;tries++)
+        {
+          child[i]=randomLayout(rng[i]);
+          key=hashOf(child[i]);
+        }
+        reseeded++;
+        if(seen.count(key)) continue;
+      }
+      seen.insert(key);
+      answer.pb(child[i]);
+      keys.pb(key);
     }
-    answer.pb(crossover(answer[r1],answer[r2]));
+    // Small puzzles can have fewer distinct layouts than the population
+    if(answer.size()==first) break;
   }
   return answer;
 }
@@ -189,84 +269,190 @@ vector<vector<Block> > GA::generation(vector<vector<Block> > &gen,int height,int
 
 void GA::bestBuddy()
 {
-  bbl.resize(X);
-  bbr.resize(X);
-  bbt.resize(X);
-  bbd.resize(X);
+  pieces->sideBuddies(buddy);
+}
 
-  for(int i=0;i<X;i++) 
-    bbl[i]=-1,bbr[i]=-1,bbt[i]=-1,bbd[i]=-1;
+double GA::diversity(vector<vector<Block> > &gen)
+{
+  // Mean fraction of slots where a sample of the population differs from gen[0]
+  int step=max(1,(int)gen.size()/DIVERSITY_SAMPLES);
+  int n=0;
+  double diff=0;
+  for(int i=step;i<gen.size();i+=step,n++)
+    for(int j=0;j<X;j++)
+      if(pieces->symbolOf(gen[i][j].idx)!=pieces->symbolOf(gen[0][j].idx)) diff++;
+  return n==0?1.0:diff/((double)n*X);
+}
 
+bool GA::buddiesSatisfied(vector<Block> &c)
+{
+  int total=0,ok=0;
+  for(int u=0;u<4*X;u++)
+    if(buddy[u]>u) total++;
   for(int i=0;i<X;i++)
-    for(int j=i+1;j<X;j++)
-    {
-      int a=-1;
-      for(int k=0;k<X;k++) if(k!=i)if(a==-1||pieces->adjl[i][k]<pieces->adjl[i][a]) a=k;
+  {
+    if((i+1)%N!=0&&buddy[4*c[i].idx+turnedSide(R,c[i].rot)]==4*c[i+1].idx+turnedSide(L,c[i+1].rot)) ok++;
+    if(i+N<X&&buddy[4*c[i].idx+turnedSide(D,c[i].rot)]==4*c[i+N].idx+turnedSide(T,c[i+N].rot)) ok++;
+  }
+  return total>0&&ok==total;
+}
 
-        int b=-1;
-      for(int k=0;k<X;k++) if(k!=j)if(b==-1||pieces->adjr[j][k]<pieces->adjr[j][b]) b=k;
+double GA::elapsed()
+{
+  return chrono::duration<double>(chrono::steady_clock::now()-start_time).count();
+}
 
-        if(a==j&&b==i)
-        {
-          bbl[i]=j,bbr[j]=i;
-        }
-        }
+vector<Block> GA::greedyLayout(MST &mst, int piece, int slot)
+{
+  vector<Block> ans(X);
+  vector<char> used(X,0);
+  for(int i=0;i<X;i++) ans[i]=pieces->dull,ans[i].idx=-1;
+  ans[slot]=pieces->block[piece];
+  used[piece]=1;
+  mst.fill_greedy(ans,used);
+  return ans;
+}
 
-  for(int i=0;i<X;i++)
-    for(int j=i+1;j<X;j++)
+vector<Block> GA::bestBuddyLayout(MST &mst, int piece)
+{
+  // Grow the best-buddy cluster around piece on an unbounded grid
+  vector<pii> cood(X,pii(INF,INF));
+  vector<int> rot(X,0);
+  set<pii> S;
+  queue<int> Q;
+  cood[piece]=pii(0,0);
+  S.insert(pii(0,0));
+  Q.push(piece);
+  while(!Q.empty())
+  {
+    int p=Q.front();
+    Q.pop();
+    int u=cood[p].first, v=cood[p].second;
+    int dir[4] = {R, D, L, T};
+    pii at[4] = {pii(u,v+1), pii(u+1,v), pii(u,v-1), pii(u-1,v)};
+    for(int i=0;i<4;i++)
     {
-      int a=-1;
-      for(int k=0;k<X;k++) if(a==-1||pieces->adjt[i][k]<pieces->adjt[i][a]) a=k;
-
-        int b=-1;
-      for(int k=0;k<X;k++) if(b==-1||pieces->adjd[j][k]<pieces->adjd[j][b]) b=k;
+      int w=buddy[4*p+turnedSide(dir[i],rot[p])];
+      int q=w==-1?-1:w/4;
+      if(q==-1||cood[q].first!=INF||S.count(at[i])) continue;
+      cood[q]=at[i];
+      rot[q]=turnFor(3-dir[i],w%4);
+      S.insert(at[i]);
+      Q.push(q);
+    }
+  }
+  return mst.layout_to_grid(cood,rot);
+}
 
-        if(a==j&&b==i)
-        {
-          bbt[i]=j,bbd[j]=i;
-        }
+vector<vector<Block> > GA::seedPopulation(int count, int height, int width)
+{
+  vector<vector<Block> > seeds(count);
+  if(count<=0) return seeds;
+
+  // Generation 0 draws the seed pieces up front as task 0
+  Stream rng(seed,0,0);
+  vector<int> piece(count), slot(count);
+  for(int i=0;i<count;i++) piece[i]=rng.below(X), slot[i]=rng.below(X);
+  int mstSeeds=min(MAX_MST_SEEDS,(count+2)/3);
+
+  MST mst(N,pieces);
+  atomic<int> next(0);
+  auto worker = [&]() {
+    for(int i=next++;i<count;i=next++)
+    {
+      if(i<mstSeeds) seeds[i]=mst.get_mst(height,width,piece[i]);
+      else if((i-mstSeeds)%2==0) seeds[i]=greedyLayout(mst,piece[i],slot[i]);
+      else seeds[i]=bestBuddyLayout(mst,piece[i]);
     }
+  };
+
+  int threads=max(1u,thread::hardware_concurrency());
+  vector<thread> pool;
+  for(int i=1;i<min(threads,count);i++) pool.pb(thread(worker));
+  worker();
+  for(int i=0;i<pool.size();i++) pool[i].join();
+  return seeds;
 }
+
 vector<Block> GA::runAlgo(int height,int width)
 {
   vector<vector<Block> > gen;
-  vector<Block> temp;
+  vector<uint64_t> keys;
   vector<vector<Block> > answer;
 
-  for(int i=0;i<1000;i++)
+  for(int j=0;j<X;j++) pieces->block[j].idx=j;
+  if(!start.empty())
+    gen.swap(start);
+  else if(init_mode==INIT_MIXED)
+    gen=seedPopulation((int)(population*seed_fraction),height,width);
+
+  for(int i=gen.size();i<population;i++)
   {
-    temp.clear();
-    for(int j=0;j<X;j++)
-    {
-      pieces->block[j].idx=j;
-      temp.pb(pieces->block[j]);
-    }
-    for(int j=0;j<X;j++)
-    {
-      int rnd;
-      rnd=rand()%X;
-      swap(temp[j],temp[rnd]);
-    }
-    gen.pb(temp);
+    Stream rng(seed,0,i+1);
+    gen.pb(randomLayout(rng));
   }
+  for(int i=0;i<gen.size();i++)
+    keys.pb(hashOf(gen[i]));
 
   double ttime;
-  for(int i=0;i<100;i++)
+  double best=startBest;
+  int stale=startStale;
+  for(int i=startGeneration;i<MAX_GENERATIONS;i++)
   {
 
-    ttime = double(clock()-start_time)/(double)(CLOCKS_PER_SEC);
-    if(ttime>=TIME_LIMIT)
+    ttime = elapsed();
+    if(timed&&ttime>=TIME_LIMIT)
     {
-      answer = bestGen(gen);
+      answer = bestGen(gen,keys);
       return answer[0];
       // saveResult(answer[0],height,width,"final.jpg");
       // exit(0);
     }
-    gen = generation(gen,height,width);
+    gen = generation(gen,keys,i+1);
+    if(migrate&&(i+1)%MIGRATION_INTERVAL==0)
+    {
+      vector<vb> out(gen.begin(),gen.begin()+min(elites,(int)gen.size()));
+      vector<vb> in=migrate(out);
+      for(int k=0;k<in.size()&&k<(int)gen.size()-elites;k++)
+      {
+        int at=gen.size()-1-k;
+        gen[at]=in[k];
+        keys[at]=hashOf(gen[at]);
+      }
+    }
+
+    // Rank the new generation, children included, and stop once its
+    // fittest layout is stable; the scores are cached for the next bestGen
+    int top=0;
+    double wt=cachedFitness(gen[0],keys[0]);
+    for(int k=1;k<gen.size();k++)
+    {
+      double w=cachedFitness(gen[k],keys[k]);
+      if(w<wt) wt=w,top=k;
+    }
+    if(best<0||wt<best) best=wt,stale=0;
+    else stale++;
+    // Mostly reseeded children mean crossover has stopped finding anything new
+    bool converged=diversity(gen)<MIN_DIVERSITY||2*reseeded>population-elites;
+    if(stale>=PLATEAU_GENERATIONS||converged||buddiesSatisfied(gen[top]))
+      return gen[top];
+
+    if(checkpoint)
+    {
+      Checkpoint c;
+      c.stage=CHECKPOINT_GA;
+      c.seed=seed;
+      c.generation=i+1;
+      c.stale=stale;
+      c.best=best;
+      c.slots.reserve((size_t)gen.size()*X*2);
+      for(int k=0;k<gen.size();k++) c.add(gen[k]);
+      checkpoint(move(c));
+    }
   }
   int pose=0;
   double min=0;
-  for(int i=0;i<1000;i++)
+  for(int i=0;i<gen.size();i++)
   {
     double wt=0;
 
@@ -275,8 +461,139 @@ vector<Block> GA::runAlgo(int height,int width)
       wt+=pieces->getWeight(gen[i],j,gen[i][j]);
     }
     if(i==0||wt<min)
-      wt=min,pose=i;
+      min=wt,pose=i;
   }
 
   return gen[pose];
-}
\ No newline at end of file
+}
+// Layouts on the wire: their count, then a piece and a turn per slot
+static vector<char> packLayouts(const vector<vb> &layouts, int X)
+{
+  vector<int> v;
+  v.pb(layouts.size());
+  for(int i=0;i<layouts.size();i++)
+    for(int j=0;j<X;j++) v.pb(layouts[i][j].idx),v.pb(layouts[i][j].rot);
+  return vector<char>((const char*)v.data(),(const char*)(v.data()+v.size()));
+}
+
+static vector<vb> unpackLayouts(const char *data, size_t size, Images *pieces)
+{
+  vector<vb> layouts;
+  int X=pieces->X,count;
+  if(size<sizeof(int)) return layouts;
+  memcpy(&count,data,sizeof(int));
+  if(size!=sizeof(int)*(1+(size_t)count*2*X)) return layouts;
+  const int *v=(const int *)(data+sizeof(int));
+  for(int i=0;i<count;i++)
+  {
+    vb c;
+    for(int j=0;j<X;j++,v+=2) c.pb(pieces->turned(v[0],v[1]));
+    layouts.pb(c);
+  }
+  return layouts;
+}
+
+// Runs one GA per worker process. Every MIGRATION_INTERVAL generations an
+// island sends its elites to the coordinator and gets back the elites the
+// island before it in the ring sent for the same round, or its last ones
+// if it has finished, so the exchange does not depend on which island is
+// faster. The fittest final layout wins, the first island on ties; if no
+// island delivers one the GA runs here instead.
+vb GA::runIslands(int n, Images *image, InitMode mode, int islands, int height, int width,
+                  uint64_t seed, bool timed)
+{
+  int X=n*n;
+  // Island k runs on the k-th draw of the run's stream
+  Stream seeds(seed);
+  vector<uint64_t> islandSeed;
+  for(int k=0;k<islands;k++) islandSeed.pb(seeds.next());
+  vector<Worker> workers=spawnWorkers(islands,[&](int k,Channel &link)
+  {
+    GA ga(n,image,mode);
+    ga.seed=islandSeed[k];
+    ga.timed=timed;
+    ga.migrate=[&](const vector<vb> &out)
+    {
+      uint32_t type;
+      vector<char> msg;
+      if(!link.send(MSG_ELITES,packLayouts(out,X))||!link.recv(type,msg)||type!=MSG_ELITES)
+        return vector<vb>();
+      return unpackLayouts(msg.data(),msg.size(),image);
+    };
+    vb best=ga.runAlgo(height,width);
+    double wt=ga.fitness(best);
+    vector<char> msg((const char*)&wt,(const char*)(&wt+1));
+    vector<char> layout=packLayouts(vector<vb>(1,best),X);
+    msg.insert(msg.end(),layout.begin(),layout.end());
+    link.send(MSG_RESULT,msg);
+  });
+
+  int count=workers.size();
+  vector<vector<vector<char> > > sent(count);  // elites per island and round
+  vector<int> waiting(count,-1);               // round an island waits on
+  vector<char> open(count,1);
+  vector<double> result(count,HUGE_VAL);
+  vector<vb> layouts(count);
+  auto answerWaiting=[&]()
+  {
+    for(int k=0;k<count;k++)
+    {
+      if(waiting[k]==-1) continue;
+      int from=(k+count-1)%count;
+      vector<char> msg;
+      if(waiting[k]<sent[from].size()) msg=sent[from][waiting[k]];
+      else if(open[from]) continue;
+      else msg=sent[from].empty()?packLayouts(vector<vb>(),X):sent[from].back();
+      workers[k].link.send(MSG_ELITES,msg);
+      waiting[k]=-1;
+    }
+  };
+  int k;
+  while((k=pollWorkers(workers,open))!=-1)
+  {
+    uint32_t type;
+    vector<char> msg;
+    if(!workers[k].link.recv(type,msg)) open[k]=0,waiting[k]=-1;
+    else if(type==MSG_ELITES)
+    {
+      waiting[k]=sent[k].size();
+      sent[k].pb(msg);
+    }
+    else if(type==MSG_RESULT&&msg.size()>sizeof(double))
+    {
+      vector<vb> layout=unpackLayouts(msg.data()+sizeof(double),msg.size()-sizeof(double),image);
+      if(layout.size()==1)
+      {
+        memcpy(&result[k],msg.data(),sizeof(double));
+        layouts[k]=layout[0];
+      }
+      open[k]=0;
+    }
+    answerWaiting();
+  }
+  if(!joinWorkers(workers)) cerr<<"An island failed"<<endl;
+  int best=-1;
+  for(int i=0;i<count;i++)
+    if(!layouts[i].empty()&&(best==-1||result[i]<result[best])) best=i;
+  if(best==-1)
+  {
+    cerr<<"No island finished, running the GA here"<<endl;
+    GA ga(n,image,mode);
+    ga.seed=seed;
+    ga.timed=timed;
+    return ga.runAlgo(height,width);
+  }
+  return layouts[best];
+}
+
+// Carries on from a population saved after generation c.generation; with
+// the same seed the run continues exactly as it would have
+void GA::resumeFrom(const Checkpoint &c)
+{
+  start.clear();
+  for(int i=0;i<c.count();i++) start.pb(c.layout(i,*pieces));
+  seed=c.seed;
+  startGeneration=c.generation;
+  startStale=c.stale;
+  startBest=c.best;
+}
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <time.h>
+#include <chrono>
 #include <algorithm>
 #include <string>
 #include <stdio.h>
@@ -13,8 +14,13 @@
 #include <sstream>
 #include <fstream>
 #include <cmath>
+#include <stdint.h>
+#include <functional>
 
 #include "image.hpp"
+#include "MST_solver.h"
+#include "rng.hpp"
+#include "checkpoint.hpp"
 
 using namespace std;
 
@@ -29,8 +35,30 @@ using namespace std;
 #define INF 1000000000
 #define TIME_LIMIT 15.0
 
+#define MAX_MST_SEEDS 4
+#define MAX_GENERATIONS 100
+#define MIN_POPULATION 64
+#define MAX_POPULATION 1000
+#define POP_PER_PIECE 4
+#define MIN_ELITES 4
+#define PLATEAU_GENERATIONS 5
+#define DIVERSITY_SAMPLES 32
+#define MIN_DIVERSITY 0.01
+#define FITNESS_CACHE_SLOTS 4096
+#define MIGRATION_INTERVAL 5
+#define CHILD_BATCH 64
+#define MAX_RESEED_SWAPS 64
+#define MAX_RESEED_LAYOUTS 4
+
 typedef vector<Block> vb;
 
+// How the initial population is built
+enum InitMode
+{
+  INIT_RANDOM,  // uniformly random permutations only
+  INIT_MIXED    // MST, greedy and best-buddy layouts, rest random
+};
+
 struct Data
 {
   double wt;
@@ -44,26 +72,69 @@ class GA
 {
 	int N,X;
 	Images* pieces;
-	vector<int> bbl, bbr, bbt, bbd;
-	clock_t start_time;
+	vector<int> buddy;           // mutual best side per piece side, see Images::sideBuddies
+	chrono::steady_clock::time_point start_time;
+	InitMode init_mode;
+	double seed_fraction;
+	int population, elites;
+	int reseeded;  // children of the last generation that were duplicates
+	vector<pair<uint64_t,double> > fitCache;  // direct-mapped, by Zobrist hash
+	vector<vb> start;            // population to resume from, see resumeFrom
+	int startGeneration, startStale;
+	double startBest;
+	double elapsed();
+	double diversity(vector<vb > &gen);
+	bool buddiesSatisfied(vb &c);
 	void bestBuddy();
-	int findbuddy(vb &c, bool * used, int k);
-	vb crossover(vb &a, vb &b);
+	Block findbuddy(vb &c, const vector<char> &used, int k);
+	uint64_t zobrist(int slot, const Block &b);
+	uint64_t hashOf(vb &c);
+	double cachedFitness(vb &c, uint64_t key);
+	vb randomLayout(Stream &rng);
+	vb crossover(vb &a, vb &b, uint64_t &key, Stream &rng);
 	double fitness(vb &c);
-	vector< vb > bestGen(vector<vb > &gen);
-	vector< vb > generation(vector<vb > &gen,int height,int width);
+	vector< vb > bestGen(vector<vb > &gen, vector<uint64_t> &keys);
+	vector< vb > generation(vector<vb > &gen, vector<uint64_t> &keys, int g);
+	vb greedyLayout(MST &mst, int piece, int slot);
+	vb bestBuddyLayout(MST &mst, int piece);
+	vector< vb > seedPopulation(int count, int height, int width);
 	
 
 public:
-	GA(int n, Images * image)
+	// Called every MIGRATION_INTERVAL generations with the elites; the
+	// layouts it returns replace the newest children. Unset on one island.
+	function<vector<vb>(const vector<vb> &)> migrate;
+	// Every random draw comes from a stream keyed by seed and task, see
+	// Stream. An untimed run stops on generations and convergence only,
+	// so the same seed gives the same layout on any machine.
+	uint64_t seed;
+	bool timed;
+	// Called after every generation the run goes on from, with a snapshot
+	// it may keep
+	function<void(Checkpoint &&)> checkpoint;
+
+	GA(int n, Images * image, InitMode mode = INIT_MIXED, double fraction = 0.1)
 	{
 		N=n;
-  		start_time=clock();
+  		start_time=chrono::steady_clock::now();
 		X = n*n;
 		pieces = image;
+		init_mode = mode;
+		seed_fraction = fraction;
+		seed = 0;
+		timed = true;
+		startGeneration = startStale = 0;
+		startBest = -1;
+		// Population scales with the puzzle; elites with the population
+		population = min(MAX_POPULATION, max(MIN_POPULATION, POP_PER_PIECE*X));
+		elites = max(MIN_ELITES, population/100);
+		fitCache.assign(FITNESS_CACHE_SLOTS, make_pair(0ULL, 0.0));
 		bestBuddy();
 	}
 	vb runAlgo(int height,int width);
+	void resumeFrom(const Checkpoint &c);
+	static vb runIslands(int n, Images * image, InitMode mode, int islands, int height, int width,
+	                     uint64_t seed, bool timed);
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,6 @@
 #include "MST_solver.h"
 
-void MST::fill_greedy(vector<Block>& ans, bool* used) {
+void MST::fill_greedy(vector<Block>& ans, vector<char>& used) {
     int CC[X];
     for (int i = 0; i < X; i++) CC[i] = 0;
 
@@ -20,7 +20,7 @@ void MST::fill_greedy(vector<Block>& ans, bool* used) {
 
     priority_queue<minDis> Q;
     for (int i = 0; i < X; i++)
-        if (!used[ans[i].idx])
+        if (ans[i].idx == -1)
             Q.push(minDis(CC[i], i));
 
     while (!Q.empty()) {
@@ -28,19 +28,21 @@ void MST::fill_greedy(vector<Block>& ans, bool* used) {
         Q.pop();
         if (ans[top.id].idx != -1) continue;
 
-        int ind = -1;
+        int ind = -1, rot = 0;
         double ma = 0.0;
         for (int i = 0; i < X; i++) {
-            if (!used[i]) {
-                double matemp = pieces->getWeight(ans, top.id, pieces->block[i]);
+            if (used[i]) continue;
+            for (int r = 0; r < pieces->turns(); r++) {
+                double matemp = pieces->getWeight(ans, top.id, pieces->turned(i, r), ind == -1 ? HUGE_VAL : ma);
                 if (ind == -1 || ma > matemp) {
                     ind = i;
+                    rot = r;
                     ma = matemp;
                 }
             }
         }
 
-        ans[top.id] = pieces->block[ind];
+        ans[top.id] = pieces->turned(ind, rot);
         used[ind] = 1;
 
         int a = top.id / N, bb = top.id % N;
@@ -56,19 +58,78 @@ void MST::fill_greedy(vector<Block>& ans, bool* used) {
 }
 
 
-vector<Block> MST::get_mst(int height,int width)
+vector<Block> MST::layout_to_grid(const vector<pii>& cood, const vector<int>& rot)
 {
-	int u,v,u1,v1,ma;
+	vector<Block> ans;
+	int ind=-1,ma=0;
+	vector<char> used(X,0);
+	for(int i=0;i<X;i++)
+	{
+		if(cood[i].first==INF) continue;
+		int x=cood[i].first;
+		int y=cood[i].second;
+		int cnt=0;
+		for(int j=0;j<X;j++) if(i!=j)
+		{
+			if(0<=cood[j].first-x&&0<=cood[j].second-y) if(N>cood[j].first-x&&N>cood[j].second-y) cnt++;
+		}
+		if(ind==-1||ma<cnt) ind=i,ma=cnt;
+	}
+
+	ans.resize(X);
+	for(int i=0;i<X;i++) ans[i] = pieces->dull,ans[i].idx=-1;
+	
+	int x=cood[ind].first;
+	int y=cood[ind].second;
+
+	for(int i=0;i<X;i++)
+	{
+		if(0<=cood[i].first-x&&0<=cood[i].second-y) if(N>cood[i].first-x&&N>cood[i].second-y)
+		{
+			used[i]=1;
+			int aa=cood[i].first-x;
+			int bb=cood[i].second-y;
+			ans[aa*N+bb]=pieces->turned(i,rot.empty()?0:rot[i]);
+		}
+	}
+	fill_greedy(ans,used);
+	return ans;
+}
+
+// Queues piece i on every side of the placed block a. Only the best turn
+// of i per side is queued, with the turn kept in the upper bits of id:
+// whether the edge is usable later does not depend on the turn.
+void MST::pushEdges(priority_queue<edges> &Q, const Block &a, int i)
+{
+	int side[4] = {R, L, T, D};
+	for(int k=0;k<4;k++)
+	{
+		int d=side[k], rot=0;
+		double w=pieces->fit(a,d,pieces->turned(i,0));
+		for(int r=1;r<pieces->turns();r++)
+		{
+			double wr=pieces->fit(a,d,pieces->turned(i,r));
+			if(wr<w) w=wr,rot=r;
+		}
+		Q.push(edges(a.idx,i,d+4*rot,w));
+	}
+}
+
+vector<Block> MST::get_mst(int height,int width,int seed)
+{
+	int u,v,u1,v1;
 	vector<Block> ans;
 	edges temp;
 	priority_queue<edges> Q;
 	while(Q.size()) Q.pop();
 
-	int ind=1;
+	// The default seed does not exist in a 1x1 puzzle
+	int ind=seed<X?seed:0;
 	bool used[X];
 
 	for(int i=0;i<X;i++) used[i]=0;
 	vector<pii> cood;
+	vector<int> rot(X,0);
 	set<pii> S;
 	for(int i=0;i<X;i++) cood.pb(make_pair(INF,INF));
 
@@ -79,12 +140,7 @@ vector<Block> MST::get_mst(int height,int width)
 
 	for(int i=0;i<X;i++) 
 	if(i!=ind)
-	{
-		Q.push(edges(ind,i,R,pieces->adjr[ind][i]));
-		Q.push(edges(ind,i,L,pieces->adjl[ind][i]));
-		Q.push(edges(ind,i,T,pieces->adjt[ind][i]));
-		Q.push(edges(ind,i,D,pieces->adjd[ind][i]));
-	}
+		pushEdges(Q,pieces->block[ind],i);
 
 	int cc=0;
 	edges ttop;
@@ -99,55 +155,21 @@ vector<Block> MST::get_mst(int height,int width)
 
 		u1=u;
 		v1=v;
-		if(ttop.id==R) v1++;
-		if(ttop.id==L) v1--;
-		if(ttop.id==T) u1--;
-		if(ttop.id==D) u1++;
+		int dir=ttop.id&3;
+		if(dir==R) v1++;
+		if(dir==L) v1--;
+		if(dir==T) u1--;
+		if(dir==D) u1++;
 		if(S.find(pii(u1,v1))!=S.end()) continue;
 		if(used[ttop.j]) continue;
 		S.insert(pii(u1,v1));
-		ans.pb(pieces->block[ttop.j]);
+		rot[ttop.j]=ttop.id>>2;
+		ans.pb(pieces->turned(ttop.j,rot[ttop.j]));
 		used[ttop.j]=1;
 		cood[ttop.j] = pii(u1,v1);
 		for(int i=0;i<X;i++) if(!used[i])
-		{
-			Q.push(edges(ttop.j,i,R,pieces->adjr[ttop.j][i]));
-			Q.push(edges(ttop.j,i,L,pieces->adjl[ttop.j][i]));
-			Q.push(edges(ttop.j,i,T,pieces->adjt[ttop.j][i]));
-			Q.push(edges(ttop.j,i,D,pieces->adjd[ttop.j][i]));
-		}
+			pushEdges(Q,ans.back(),i);
 	}
 
-	ans.clear();
-	ind=-1,ma=0;
-	for(int i=0;i<X;i++)
-	{
-		int x=cood[i].first;
-		int y=cood[i].second;
-		int cnt=0;
-		for(int j=0;j<X;j++) if(i!=j)
-		{
-			if(0<=cood[j].first-x&&0<=cood[j].second-y) if(N>cood[j].first-x&&N>cood[j].second-y) cnt++;
-		}
-		if(ind==-1||ma<cnt) ind=i,ma=cnt;
-	}
-
-	ans.resize(X);
-	for(int i=0;i<X;i++) used[i]=0,ans[i] = pieces->dull,ans[i].idx=-1;
-	
-	int x=cood[ind].first;
-	int y=cood[ind].second;
-
-	for(int i=0;i<X;i++)
-	{
-		if(0<=cood[i].first-x&&0<=cood[i].second-y) if(N>cood[i].first-x&&N>cood[i].second-y)
-		{
-			used[i]=1;
-			int aa=cood[i].first-x;
-			int bb=cood[i].second-y;
-			ans[aa*N+bb]=pieces->block[i];
-		}
-	}
-	fill_greedy(ans,used);
-	return ans;
+	return layout_to_grid(cood,rot);
 }
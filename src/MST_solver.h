@@ -33,9 +33,10 @@ struct minDis
 {
 	int cc;
 	int id;
+	// Most constrained slot (most placed neighbours) first
 	bool operator <(const minDis &x)const
 	{
-		return this->cc > x.cc;
+		return this->cc < x.cc;
 	}
 	minDis() : cc(0),id(-1) {}
 	minDis(int c,int i)
@@ -70,11 +71,13 @@ class MST
 {
 	int N,X;
 	Images* pieces;
-	
+	void pushEdges(priority_queue<edges> &Q, const Block &a, int i);
+
 public:
 	MST(int n, Images * image):N(n),X(n*n),pieces(image){}
-	vector<Block> get_mst(int height, int width);
-	void fill_greedy(vector<Block> & ans, bool * used);
+	vector<Block> get_mst(int height, int width, int seed = 1);
+	vector<Block> layout_to_grid(const vector<pii> & cood, const vector<int> & rot = vector<int>());
+	void fill_greedy(vector<Block> & ans, vector<char> & used);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+#ifndef ANN_HPP
+#define ANN_HPP
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <stdint.h>
+
+#include "descriptors.hpp"
+
+using namespace std;
+
+#define VP_LEAF 8
+#define ANN_BLOCKS 4
+#define ANN_CANDIDATES 32
+
+// Vantage-point tree over n vectors of `dim` floats under Euclidean
+// distance. Every inner node splits the points below it at the median
+// distance from its vantage point, so a k-nearest query only descends
+// into a half whose distance band can still hold something closer than
+// the k-th best found so far.
+class VPTree {
+public:
+    int n, dim;
+
+    VPTree() : n(0), dim(0) {}
+
+    void build(const vector<float>& points, int count, int d) {
+        pts = points;
+        n = count;
+        dim = d;
+        order.resize(n);
+        for (int i = 0; i < n; i++) order[i] = i;
+        nodes.clear();
+        nodes.reserve(2 * (n / VP_LEAF + 1));
+        dist.resize(n);
+        uint64_t seed = 88172645463325252ULL;
+        if (n > 0) build(0, n, seed);
+        dist.clear();
+        dist.shrink_to_fit();
+    }
+
+    // The k points nearest to q, nearest first, leaving out point skip
+    void search(const float* q, int k, int skip, vector<pair<float, int> >& out) const {
+        priority_queue<pair<float, int> > best;  // farthest kept point on top
+        float tau = HUGE_VALF;
+        if (n > 0 && k > 0) search(0, q, k, skip, best, tau);
+        out.resize(best.size());
+        for (int i = (int)best.size() - 1; i >= 0; i--) {
+            out[i] = best.top();
+            best.pop();
+        }
+    }
+
+private:
+    // A leaf holds order[lo, hi); an inner node has vantage point order[lo]
+    // with the points within radius in `inside` and the rest in `outside`
+    struct Node {
+        int lo, hi;
+        float radius;
+        int inside, outside;
+    };
+
+    vector<float> pts;
+    vector<int> order;
+    vector<Node> nodes;
+    vector<float> dist;  // scratch while building
+
+    float distance(const float* a, const float* b) const {
+        float ans = 0;
+        for (int i = 0; i < dim; i++) {
+            float d = a[i] - b[i];
+            ans += d * d;
+        }
+        return sqrt(ans);
+    }
+
+    const float* point(int i) const { return &pts[(size_t)i * dim]; }
+
+    int build(int lo, int hi, uint64_t& seed) {
+        int at = nodes.size();
+        Node node;
+        node.lo = lo, node.hi = hi, node.radius = 0, node.inside = node.outside = -1;
+        nodes.push_back(node);
+        if (hi - lo <= VP_LEAF) return at;
+
+        // xorshift; the tree only needs some spread in its vantage points
+        seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+        swap(order[lo], order[lo + seed % (hi - lo)]);
+        const float* vp = point(order[lo]);
+        for (int i = lo + 1; i < hi; i++) dist[order[i]] = distance(vp, point(order[i]));
+        int mid = (lo + 1 + hi) / 2;
+        nth_element(order.begin() + lo + 1, order.begin() + mid, order.begin() + hi,
+                    [this](int a, int b) { return dist[a] < dist[b]; });
+        float radius = dist[order[mid]];
+        int inside = build(lo + 1, mid, seed);
+        int outside = build(mid, hi, seed);
+        nodes[at].radius = radius;
+        nodes[at].inside = inside;
+        nodes[at].outside = outside;
+        return at;
+    }
+
+    void offer(int id, float d, int k, int skip, priority_queue<pair<float, int> >& best, float& tau) const {
+        if (id == skip || d >= tau) return;
+        best.push(make_pair(d, id));
+        if ((int)best.size() > k) best.pop();
+        if ((int)best.size() == k) tau = best.top().first;
+    }
+
+    void search(int at, const float* q, int k, int skip, priority_queue<pair<float, int> >& best, float& tau) const {
+        const Node& node = nodes[at];
+        if (node.inside == -1) {
+            for (int i = node.lo; i < node.hi; i++) offer(order[i], distance(q, point(order[i])), k, skip, best, tau);
+            return;
+        }
+        float d = distance(q, point(order[node.lo]));
+        offer(order[node.lo], d, k, skip, best, tau);
+        if (d < node.radius) {
+            if (d - tau <= node.radius) search(node.inside, q, k, skip, best, tau);
+            if (d + tau >= node.radius) search(node.outside, q, k, skip, best, tau);
+        } else {
+            if (d + tau >= node.radius) search(node.outside, q, k, skip, best, tau);
+            if (d - tau <= node.radius) search(node.inside, q, k, skip, best, tau);
+        }
+    }
+};
+
+// Approximate top-K matches for every edge. Each strip is reduced to
+// per channel means over ANN_BLOCKS runs along the edge, scaled so that
+// the squared distance between two reduced strips is a lower bound on
+// their SSD, as with the coarse summaries. Strips are indexed block
+// reversed, so a query with the facing strip in its own order measures
+// them placed against each other. The ANN_CANDIDATES nearest in the
+// reduced space are then ranked on the full strips.
+class EdgeIndex {
+public:
+    void build(const EdgeDescriptors& desc) {
+        for (int s = 0; s < 4; s++) {
+            int n = s == 0 || s == 3 ? desc.height : desc.width;
+            blocks[s] = min(ANN_BLOCKS, n);
+            while (n % blocks[s]) blocks[s]--;
+            int dim = blocks[s] * 3;
+            vector<float> points((size_t)desc.count * dim);
+            vector<float> v(dim);
+            for (int i = 0; i < desc.count; i++) {
+                reduce(desc, i, s, v.data());
+                float* p = &points[(size_t)i * dim];
+                for (int b = 0; b < blocks[s]; b++)
+                    for (int c = 0; c < 3; c++) p[b * 3 + c] = v[(blocks[s] - 1 - b) * 3 + c];
+            }
+            tree[s].build(points, desc.count, dim);
+        }
+    }
+
+    // The k pieces that fit best on side d of i among those the index
+    // offers, best first
+    void matches(const EdgeDescriptors& desc, int i, int d, int k, vector<pair<double, int> >& out) const {
+        vector<float> q(blocks[d] * 3);
+        reduce(desc, i, d, q.data());
+        vector<pair<float, int> > near;
+        tree[3 - d].search(q.data(), max(k, ANN_CANDIDATES), i, near);
+        priority_queue<pair<double, int> > best;  // worst kept match on top
+        for (int n = 0; n < near.size(); n++) {
+            bool full = (int)best.size() == k;
+            double bound = full ? best.top().first : HUGE_VAL;
+            // Reduced distances only grow from here on
+            if (full && (double)near[n].first * near[n].first >= bound) break;
+            double v = (double)desc.facing(i, d, near[n].second, 3 - d, full ? (long long)bound : LLONG_MAX);
+            if (full && v >= bound) continue;
+            best.push(make_pair(v, near[n].second));
+            if ((int)best.size() > k) best.pop();
+        }
+        out.resize(best.size());
+        for (int n = (int)best.size() - 1; n >= 0; n--) {
+            out[n] = best.top();
+            best.pop();
+        }
+    }
+
+private:
+    int blocks[4];
+    VPTree tree[4];
+
+    void reduce(const EdgeDescriptors& desc, int i, int s, float* v) const {
+        const unsigned char* strip = desc.get(i, s);
+        int per = desc.len[s] / (3 * blocks[s]);
+        float scale = 1.0f / sqrt((float)per);
+        for (int b = 0; b < blocks[s]; b++) {
+            int sum[3] = {0, 0, 0};
+            for (int e = 0; e < per; e++)
+                for (int c = 0; c < 3; c++) sum[c] += strip[(b * per + e) * 3 + c];
+            for (int c = 0; c < 3; c++) v[b * 3 + c] = sum[c] * scale;
+        }
+    }
+};
+
+#endif
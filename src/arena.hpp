@@ -0,0 +1,57 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#define ARENA_ALIGN 64
+
+// Pixels of every piece in one aligned allocation: 8-bit interleaved BGR
+// as decoded by OpenCV, one piece after another, each starting on a cache
+// line boundary.
+class PieceArena {
+public:
+    unsigned char* data;
+    int count, height, width;
+    size_t stride;
+
+    PieceArena() : data(nullptr), count(0), height(0), width(0), stride(0) {}
+    ~PieceArena() { free(data); }
+
+    void allocate(int n, int h, int w) {
+        free(data);
+        count = n;
+        height = h;
+        width = w;
+        size_t bytes = (size_t)h * w * 3;
+        stride = (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+        data = (unsigned char*)aligned_alloc(ARENA_ALIGN, stride * (n > 0 ? n : 1));
+        if (!data) throw std::bad_alloc();
+        memset(data, 0, stride * n);
+    }
+
+    // Room for n pieces, keeping the pixels stored so far. Pointers into
+    // the arena are invalidated.
+    void grow(int n) {
+        if (n <= count) return;
+        unsigned char* next = (unsigned char*)aligned_alloc(ARENA_ALIGN, stride * n);
+        if (!next) throw std::bad_alloc();
+        memcpy(next, data, stride * count);
+        memset(next + stride * count, 0, stride * (n - count));
+        free(data);
+        data = next;
+        count = n;
+    }
+
+    unsigned char* piece(int i) const { return data + stride * i; }
+
+    // Bytes of pixel data per piece, without the alignment padding
+    size_t pieceBytes() const { return (size_t)height * width * 3; }
+
+private:
+    PieceArena(const PieceArena&);
+    PieceArena& operator=(const PieceArena&);
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image.hpp"
+
+using namespace std;
+
+#define CHECKPOINT_MAGIC 0x504b434a  // "JCKP"
+#define CHECKPOINT_VERSION 1
+
+enum CheckpointStage
+{
+    CHECKPOINT_GA,     // a GA population between generations
+    CHECKPOINT_LAYOUT  // one finished arrangement, before or during refining
+};
+
+// What a run needs to carry on where it stopped. The compatibility scores
+// are not part of it: key is the cache key of the pieces (see
+// Images::cacheKey), which ties the checkpoint to the pieces it was made
+// for and to the compat.cache file that holds their scores.
+struct Checkpoint
+{
+    int stage;
+    uint64_t key;
+    bool rotations;
+    uint64_t seed;        // the GA's streams are keyed by seed and generation
+    int generation;
+    int stale;
+    double best;
+    int X;                  // slots per layout
+    vector<int32_t> slots;  // a piece and a turn per slot, layout after layout
+
+    Checkpoint() : stage(CHECKPOINT_LAYOUT), key(0), rotations(false), seed(0), generation(0), stale(0), best(-1), X(0) {}
+
+    int count() const { return X ? slots.size() / (2 * X) : 0; }
+
+    // Only the piece and turn of every slot are kept, a quarter of a Block
+    void add(const vector<Block>& layout) {
+        X = layout.size();
+        for (int j = 0; j < X; j++) slots.push_back(layout[j].idx), slots.push_back(layout[j].rot);
+    }
+
+    vector<Block> layout(int i, const Images& pieces) const {
+        vector<Block> ans;
+        for (int j = 0; j < X; j++) {
+            const int32_t* e = &slots[((size_t)i * X + j) * 2];
+            ans.push_back(pieces.turned(e[0], e[1]));
+        }
+        return ans;
+    }
+};
+
+// On disk: this header, then a piece and a turn per slot of every layout
+struct CheckpointHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t seed;
+    int32_t X;
+    int32_t stage;
+    int32_t rotations;
+    int32_t generation;
+    int32_t stale;
+    int32_t count;
+    double best;
+};
+
+// Written through a temporary file and a rename, so a run killed while
+// writing leaves the previous checkpoint intact
+inline bool saveCheckpoint(const string& path, const Checkpoint& c) {
+    CheckpointHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = CHECKPOINT_MAGIC;
+    h.version = CHECKPOINT_VERSION;
+    h.key = c.key;
+    h.seed = c.seed;
+    h.X = c.X;
+    h.stage = c.stage;
+    h.rotations = c.rotations;
+    h.generation = c.generation;
+    h.stale = c.stale;
+    h.count = c.count();
+    h.best = c.best;
+    const vector<int32_t>& v = c.slots;
+    string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return false;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(v.data(), sizeof(int32_t), v.size(), fp) == v.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// False if there is no checkpoint, or it was made for other pieces or
+// settings
+inline bool loadCheckpoint(const string& path, Images& pieces, uint64_t key, Checkpoint& c) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) return false;
+    CheckpointHeader h;
+    bool ok = fread(&h, sizeof(h), 1, fp) == 1 && h.magic == CHECKPOINT_MAGIC && h.version == CHECKPOINT_VERSION &&
+              h.key == key && h.X == pieces.X && h.rotations == pieces.rotations && h.count > 0 &&
+              (h.stage == CHECKPOINT_GA || h.stage == CHECKPOINT_LAYOUT);
+    vector<int32_t> v;
+    if (ok) {
+        v.resize((size_t)h.count * h.X * 2);
+        ok = fread(v.data(), sizeof(int32_t), v.size(), fp) == v.size();
+    }
+    fclose(fp);
+    for (size_t i = 0; ok && i < v.size(); i += 2)
+        if (v[i] < 0 || v[i] >= h.X || v[i + 1] < 0 || v[i + 1] > 3) ok = false;
+    if (!ok) return false;
+    c.stage = h.stage;
+    c.key = h.key;
+    c.rotations = h.rotations;
+    c.seed = h.seed;
+    c.generation = h.generation;
+    c.stale = h.stale;
+    c.best = h.best;
+    c.X = h.X;
+    c.slots.swap(v);
+    return true;
+}
+
+// Writes checkpoints on a thread of its own. submit takes the snapshot
+// over without copying it; if the writer is still busy, a newer snapshot
+// replaces the one waiting, so a slow disk never holds up the solver. The
+// last snapshot is written before the destructor returns.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const string& file) : path(file), pending(false), stop(false) {
+        writer = thread([this]() { run(); });
+    }
+
+    ~CheckpointWriter() {
+        {
+            lock_guard<mutex> lock(m);
+            stop = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+
+    void submit(Checkpoint&& c) {
+        {
+            lock_guard<mutex> lock(m);
+            next = move(c);
+            pending = true;
+        }
+        wake.notify_one();
+    }
+
+private:
+    string path;
+    Checkpoint next;
+    bool pending, stop;
+    mutex m;
+    condition_variable wake;
+    thread writer;
+
+    void run() {
+        unique_lock<mutex> lock(m);
+        while (true) {
+            wake.wait(lock, [this]() { return pending || stop; });
+            if (!pending) return;
+            Checkpoint c;
+            swap(c, next);
+            pending = false;
+            lock.unlock();
+            if (!saveCheckpoint(path, c)) cerr << "Failed to write " << path << endl;
+            lock.lock();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef COMPAT_HPP
+#define COMPAT_HPP
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Axes of the compatibility store. The right and down scores are the
+// transposes of the left and top ones, so only these two are kept.
+#define AXIS_H 0
+#define AXIS_V 1
+
+#define CACHE_MAGIC 0x4343534a  // "JSCC"
+#define CACHE_VERSION 1
+
+enum Precision
+{
+    PRECISION_FLOAT,  // 32-bit float scores
+    PRECISION_U16     // 16-bit quantized sqrt(score)
+};
+
+inline uint16_t quantize(double v, double step) {
+    double s = sqrt(v) / step + 0.5;
+    return s >= 65535.0 ? 65535 : (uint16_t)s;
+}
+
+inline double dequantize(uint16_t v, double step) {
+    double s = v * step;
+    return s * s;
+}
+
+// Header of the on-disk cache, followed directly by the score payload
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    int32_t X;
+    int32_t precision;
+    double step;
+};
+
+// Dissimilarity scores for every ordered pair of pieces along both axes.
+// In 16-bit mode sqrt(score) is quantized against the largest possible
+// edge SSD, which keeps most of the resolution for the small scores that
+// decide the matches. The scores live either in owned buffers or in a
+// read-only mapping of a cache file. Rows are `stride` entries apart, so
+// an incrementally built store can hold more pieces than it currently
+// scores.
+class CompatStore {
+public:
+    int X, stride;
+    Precision precision;
+    double step;
+    float* f;
+    uint16_t* q;
+
+    CompatStore() : X(0), stride(0), precision(PRECISION_FLOAT), step(1.0), f(nullptr), q(nullptr),
+                    mapped(nullptr), mappedLen(0) {}
+    ~CompatStore() { unmap(); }
+
+    // maxScore is the largest value set() will ever be called with
+    void init(int n, Precision p, double maxScore, int capacity = 0) {
+        unmap();
+        X = n;
+        stride = max(n, capacity);
+        precision = p;
+        step = sqrt(maxScore) / 65535.0;
+        size_t cells = 2 * (size_t)stride * stride;
+        fbuf.clear();
+        qbuf.clear();
+        if (precision == PRECISION_U16) {
+            qbuf.assign(cells, 0);
+            q = qbuf.data();
+            f = nullptr;
+        } else {
+            fbuf.assign(cells, 0.0f);
+            f = fbuf.data();
+            q = nullptr;
+        }
+    }
+
+    void set(int axis, int i, int j, double v) {
+        size_t at = ((size_t)axis * stride + i) * stride + j;
+        if (precision == PRECISION_U16) q[at] = quantize(v, step);
+        else f[at] = (float)v;
+    }
+
+    double get(int axis, int i, int j) const {
+        size_t at = ((size_t)axis * stride + i) * stride + j;
+        if (precision == PRECISION_U16) return dequantize(q[at], step);
+        return f[at];
+    }
+
+    // Extends the store to n pieces, keeping the scores computed so far;
+    // the capacity at least doubles whenever it runs out.
+    void grow(int n) {
+        if (n > stride) {
+            int cap = max(n, 2 * stride);
+            if (precision == PRECISION_U16) regrow(qbuf, q, cap);
+            else regrow(fbuf, f, cap);
+            stride = cap;
+        }
+        X = n;
+    }
+
+    size_t bytes() const {
+        return 2 * (size_t)X * X * (precision == PRECISION_U16 ? sizeof(uint16_t) : sizeof(float));
+    }
+
+    // Maps a cache file written by save() with the same key and layout.
+    // Returns false, leaving the store untouched, on any mismatch.
+    bool load(const string& path, uint64_t key) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        CacheHeader h;
+        bool ok = fstat(fd, &st) == 0 && read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) &&
+                  h.magic == CACHE_MAGIC && h.version == CACHE_VERSION && h.key == key &&
+                  h.X == X && h.precision == precision &&
+                  (size_t)st.st_size == sizeof(h) + bytes();
+        void* m = ok ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (m == MAP_FAILED) return false;
+
+        fbuf.clear();
+        qbuf.clear();
+        fbuf.shrink_to_fit();
+        qbuf.shrink_to_fit();
+        mapped = m;
+        mappedLen = st.st_size;
+        stride = X;
+        step = h.step;
+        // The mapping is private and never written through
+        void* payload = (char*)m + sizeof(h);
+        f = precision == PRECISION_FLOAT ? (float*)payload : nullptr;
+        q = precision == PRECISION_U16 ? (uint16_t*)payload : nullptr;
+        return true;
+    }
+
+    // Writes the scores next to the pieces; the rename keeps concurrent
+    // readers from mapping a half-written file.
+    bool save(const string& path, uint64_t key) const {
+        if (stride != X) return false;
+        CacheHeader h;
+        memset(&h, 0, sizeof(h));
+        h.magic = CACHE_MAGIC;
+        h.version = CACHE_VERSION;
+        h.key = key;
+        h.X = X;
+        h.precision = precision;
+        h.step = step;
+        string tmp = path + ".tmp";
+        FILE* fp = fopen(tmp.c_str(), "wb");
+        if (!fp) return false;
+        const void* payload = precision == PRECISION_U16 ? (const void*)q : (const void*)f;
+        bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(payload, 1, bytes(), fp) == bytes();
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    vector<float> fbuf;
+    vector<uint16_t> qbuf;
+    void* mapped;
+    size_t mappedLen;
+
+    template <class T>
+    void regrow(vector<T>& buf, T*& ptr, int cap) {
+        vector<T> next(2 * (size_t)cap * cap, 0);
+        for (int a = 0; a < 2; a++)
+            for (int i = 0; i < X; i++)
+                memcpy(&next[((size_t)a * cap + i) * cap], ptr + ((size_t)a * stride + i) * stride, X * sizeof(T));
+        buf.swap(next);
+        ptr = buf.data();
+    }
+
+    void unmap() {
+        if (mapped) munmap(mapped, mappedLen);
+        mapped = nullptr;
+        mappedLen = 0;
+    }
+
+    CompatStore(const CompatStore&);
+    CompatStore& operator=(const CompatStore&);
+};
+
+// Dissimilarity of every pair of piece sides, for pieces of unknown
+// orientation. Side s of piece i is entry 4*i+s. Which two sides meet
+// decides the score, not how the pieces are turned, and the score of two
+// facing sides does not depend on which is named first, so only one
+// triangle is kept: 8 X^2 entries, against 2 X^2 in a CompatStore and
+// 32 X^2 for a pair of matrices per relative rotation.
+class SideCompat {
+public:
+    int X;
+    Precision precision;
+    double step;
+
+    SideCompat() : X(0), precision(PRECISION_FLOAT), step(1.0) {}
+
+    void init(int n, Precision p, double maxScore) {
+        X = n;
+        precision = p;
+        step = sqrt(maxScore) / 65535.0;
+        size_t cells = index(4 * (size_t)n, 0);
+        fbuf.clear();
+        qbuf.clear();
+        if (precision == PRECISION_U16) qbuf.assign(cells, 0);
+        else fbuf.assign(cells, 0.0f);
+    }
+
+    void set(int u, int v, double s) {
+        size_t at = index(u, v);
+        if (precision == PRECISION_U16) qbuf[at] = quantize(s, step);
+        else fbuf[at] = (float)s;
+    }
+
+    double get(int u, int v) const {
+        size_t at = index(u, v);
+        if (precision == PRECISION_U16) return dequantize(qbuf[at], step);
+        return fbuf[at];
+    }
+
+    size_t bytes() const {
+        return fbuf.size() * sizeof(float) + qbuf.size() * sizeof(uint16_t);
+    }
+
+private:
+    vector<float> fbuf;
+    vector<uint16_t> qbuf;
+
+    static size_t index(size_t u, size_t v) {
+        if (u < v) swap(u, v);
+        return u * (u + 1) / 2 + v;
+    }
+};
+
+#define HASH_SEED 14695981039346656037ULL
+
+// FNV-1a, used to key the cache on piece content and metric settings
+inline uint64_t hashBytes(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline bool parsePrecision(const string& s, Precision& p) {
+    if (s == "float") p = PRECISION_FLOAT;
+    else if (s == "u16") p = PRECISION_U16;
+    else return false;
+    return true;
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef DESCRIPTORS_HPP
+#define DESCRIPTORS_HPP
+
+#include <vector>
+#include <climits>
+#include <string.h>
+
+using namespace std;
+
+#define COARSE_BLOCK 4
+
+// Border strips of every piece, `depth` pixels deep, copied out of the
+// arena into one flat array per side. Every strip is read clockwise around
+// the piece (top left to right, right top to bottom, bottom right to left,
+// left bottom to top), so turning a piece only changes which strip faces
+// which way, and two facing strips always run in opposite directions.
+// Entry k of a strip holds the `depth` pixels at position k along the
+// edge, nearest to the edge first. Sides are indexed by R, T, D, L.
+//
+// Every strip also has a coarse summary: per channel sums over blocks of
+// block[s] consecutive entries. A block of m pixel pairs whose channel
+// sums differ by e contributes at least e*e/m to the SSD, so the summaries
+// give a cheap lower bound that rejects most pairs in top-K searches.
+class EdgeDescriptors {
+public:
+    int count, depth, height, width;
+    int len[4];
+    int block[4];
+    vector<unsigned char> side[4];
+    vector<int> coarse[4];
+
+    EdgeDescriptors() : count(0), depth(0), height(0), width(0) {}
+
+    void init(int n, int h, int w, int d) {
+        count = n;
+        height = h;
+        width = w;
+        depth = d;
+        len[0] = len[3] = h * d * 3;  // R, L
+        len[1] = len[2] = w * d * 3;  // T, D
+        for (int s = 0; s < 4; s++) {
+            // Blocks must tile the strip for facing blocks to line up
+            int n = s == 0 || s == 3 ? h : w;
+            block[s] = COARSE_BLOCK;
+            while (n % block[s]) block[s]--;
+            side[s].assign((size_t)count * len[s], 0);
+            coarse[s].assign((size_t)count * blocks(s) * 3, 0);
+        }
+    }
+
+    void grow(int n) {
+        if (n <= count) return;
+        for (int s = 0; s < 4; s++) {
+            side[s].resize((size_t)n * len[s], 0);
+            coarse[s].resize((size_t)n * blocks(s) * 3, 0);
+        }
+        count = n;
+    }
+
+    // pixels is one piece in the arena layout: rows of interleaved BGR
+    void extract(int i, const unsigned char* pixels) {
+        size_t rowBytes = (size_t)width * 3;
+        unsigned char* r = get(i, 0);
+        unsigned char* t = get(i, 1);
+        unsigned char* d = get(i, 2);
+        unsigned char* l = get(i, 3);
+        for (int k = 0; k < height; k++) {
+            for (int j = 0; j < depth; j++) {
+                memcpy(r + (k * depth + j) * 3, pixels + k * rowBytes + (width - 1 - j) * 3, 3);
+                memcpy(l + (k * depth + j) * 3, pixels + (height - 1 - k) * rowBytes + j * 3, 3);
+            }
+        }
+        for (int k = 0; k < width; k++) {
+            for (int j = 0; j < depth; j++) {
+                memcpy(t + (k * depth + j) * 3, pixels + j * rowBytes + k * 3, 3);
+                memcpy(d + (k * depth + j) * 3, pixels + (height - 1 - j) * rowBytes + (width - 1 - k) * 3, 3);
+            }
+        }
+        for (int s = 0; s < 4; s++) {
+            const unsigned char* strip = get(i, s);
+            int* sums = &coarse[s][(size_t)i * blocks(s) * 3];
+            int per = block[s] * depth;
+            for (int b = 0; b < blocks(s); b++) {
+                sums[b * 3] = sums[b * 3 + 1] = sums[b * 3 + 2] = 0;
+                for (int e = 0; e < per; e++)
+                    for (int c = 0; c < 3; c++) sums[b * 3 + c] += strip[(b * per + e) * 3 + c];
+            }
+        }
+    }
+
+    int blocks(int s) const { return len[s] / (3 * depth * block[s]); }
+
+    // SSD of side s of piece i against side t of piece j placed against
+    // it; the strips must have the same length. Accumulation stops, at a
+    // block boundary, as soon as the sum reaches bound.
+    long long facing(int i, int s, int j, int t, long long bound = LLONG_MAX) const {
+        const unsigned char* a = get(i, s);
+        const unsigned char* b = get(j, t);
+        int entry = depth * 3;
+        int n = len[s] / entry;
+        long long ans = 0;
+        for (int k = 0; k < n; k++) {
+            const unsigned char* x = a + k * entry;
+            const unsigned char* y = b + (n - 1 - k) * entry;
+            for (int c = 0; c < entry; c++) {
+                int v = x[c] - y[c];
+                ans += v * v;
+            }
+            if ((k + 1) % block[s] == 0 && ans >= bound) return ans;
+        }
+        return ans;
+    }
+
+    // Lower bound on facing(i, s, j, t) from the coarse summaries
+    double coarseBound(int i, int s, int j, int t) const {
+        int nb = blocks(s);
+        const int* x = &coarse[s][(size_t)i * nb * 3];
+        const int* y = &coarse[t][(size_t)j * nb * 3];
+        long long ans = 0;
+        for (int b = 0; b < nb; b++)
+            for (int c = 0; c < 3; c++) {
+                long long e = x[b * 3 + c] - y[(nb - 1 - b) * 3 + c];
+                ans += e * e;
+            }
+        return (double)ans / (block[s] * depth);
+    }
+
+    // SSD between side s of i and side s of j read the same way, which is
+    // small when the two edges look alike; stops like facing
+    long long alike(int i, int j, int s, long long bound = LLONG_MAX) const {
+        const unsigned char* a = get(i, s);
+        const unsigned char* b = get(j, s);
+        int per = block[s] * depth * 3;
+        long long ans = 0;
+        for (int k = 0; k < len[s]; k++) {
+            int v = a[k] - b[k];
+            ans += v * v;
+            if ((k + 1) % per == 0 && ans >= bound) return ans;
+        }
+        return ans;
+    }
+
+    // Lower bound on alike(i, j, s) from the coarse summaries
+    double coarseAlike(int i, int j, int s) const {
+        int nb = blocks(s);
+        const int* x = &coarse[s][(size_t)i * nb * 3];
+        const int* y = &coarse[s][(size_t)j * nb * 3];
+        long long ans = 0;
+        for (int k = 0; k < nb * 3; k++) {
+            long long e = x[k] - y[k];
+            ans += e * e;
+        }
+        return (double)ans / (block[s] * depth);
+    }
+
+    unsigned char* get(int i, int s) { return side[s].data() + (size_t)i * len[s]; }
+    const unsigned char* get(int i, int s) const { return side[s].data() + (size_t)i * len[s]; }
+};
+
+// Side of an unturned piece that faces direction d once the piece is
+// turned r quarter turns clockwise, and the turn that makes side s face
+// direction d. Clockwise the sides run T, R, D, L.
+inline int turnedSide(int d, int r) {
+    // Sides in clockwise order, which is also the clockwise position of R, T, D, L
+    static const int cw[4] = {1, 0, 2, 3};
+    return cw[(cw[d] - r + 4) & 3];
+}
+
+inline int turnFor(int d, int s) {
+    static const int cw[4] = {1, 0, 2, 3};
+    return (cw[d] - cw[s] + 4) & 3;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+enum MessageType {
+    MSG_SHARD = 1,   // rows of scores or candidates computed by a worker
+    MSG_ELITES = 2,  // GA layouts sent to or from an island
+    MSG_RESULT = 3   // an island's final layout
+};
+
+// Framed messages over a stream file descriptor, which may be a pipe, a
+// local socket or a TCP connection. A frame is a 4 byte type and an 8 byte
+// payload length in host byte order, followed by the payload.
+class Channel {
+public:
+    int fd;
+
+    explicit Channel(int f = -1) : fd(f) {}
+
+    bool send(uint32_t type, const void* data, size_t size) {
+        uint64_t length = size;
+        return writeAll(&type, sizeof(type)) && writeAll(&length, sizeof(length)) && writeAll(data, size);
+    }
+
+    bool send(uint32_t type, const vector<char>& payload) { return send(type, payload.data(), payload.size()); }
+
+    // False on end of stream or a read error
+    bool recv(uint32_t& type, vector<char>& payload) {
+        uint64_t length;
+        if (!readAll(&type, sizeof(type)) || !readAll(&length, sizeof(length))) return false;
+        payload.resize(length);
+        return readAll(payload.data(), length);
+    }
+
+    void close() {
+        if (fd != -1) ::close(fd);
+        fd = -1;
+    }
+
+private:
+    bool writeAll(const void* data, size_t size) {
+        const char* p = (const char*)data;
+        while (size > 0) {
+            ssize_t n = ::write(fd, p, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n, size -= n;
+        }
+        return true;
+    }
+
+    bool readAll(void* data, size_t size) {
+        char* p = (char*)data;
+        while (size > 0) {
+            ssize_t n = ::read(fd, p, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n, size -= n;
+        }
+        return true;
+    }
+};
+
+struct Worker {
+    pid_t pid;
+    Channel link;
+};
+
+// Forks n worker processes, each joined to the coordinator by a local
+// socket pair. Worker k runs body(k, link) on a copy-on-write image of the
+// coordinator's memory and exits without running destructors. Stops early
+// if a process cannot be started, so callers must check the count.
+inline vector<Worker> spawnWorkers(int n, function<void(int, Channel&)> body) {
+    vector<Worker> workers;
+    // Buffered output would otherwise be written once per process
+    cout.flush();
+    fflush(NULL);
+    for (int k = 0; k < n; k++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+        pid_t pid = fork();
+        if (pid < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            break;
+        }
+        if (pid == 0) {
+            ::close(fds[0]);
+            for (int i = 0; i < workers.size(); i++) workers[i].link.close();
+            Channel link(fds[1]);
+            body(k, link);
+            link.close();
+            cout.flush();
+            fflush(NULL);
+            _exit(0);
+        }
+        ::close(fds[1]);
+        Worker w;
+        w.pid = pid;
+        w.link = Channel(fds[0]);
+        workers.push_back(w);
+    }
+    return workers;
+}
+
+// Closes every link and waits for the processes; false if one failed
+inline bool joinWorkers(vector<Worker>& workers) {
+    bool ok = true;
+    for (int i = 0; i < workers.size(); i++) {
+        workers[i].link.close();
+        int status;
+        if (waitpid(workers[i].pid, &status, 0) != workers[i].pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+    workers.clear();
+    return ok;
+}
+
+// Splits [0, total) into one contiguous range per worker process. Every
+// worker computes compute(lo, hi) and sends it back as one shard, which
+// the coordinator passes to apply(lo, hi, shard). False if a worker could
+// not be started or did not deliver, in which case the caller should do
+// the work itself.
+inline bool runSharded(int count, int total, function<vector<char>(int, int)> compute,
+                       function<void(int, int, const vector<char>&)> apply) {
+    count = max(1, min(count, total));
+    vector<int> bounds;
+    for (int k = 0; k <= count; k++) bounds.push_back((int)((long long)total * k / count));
+    vector<Worker> workers = spawnWorkers(count, [&](int k, Channel& link) {
+        vector<char> shard = compute(bounds[k], bounds[k + 1]);
+        link.send(MSG_SHARD, shard);
+    });
+    bool ok = (int)workers.size() == count;
+    vector<char> shard;
+    uint32_t type;
+    for (int k = 0; ok && k < count; k++) {
+        if (!workers[k].link.recv(type, shard) || type != MSG_SHARD) ok = false;
+        else apply(bounds[k], bounds[k + 1], shard);
+    }
+    return joinWorkers(workers) && ok;
+}
+
+// Waits until one of the links has data and returns its index, or -1
+inline int pollWorkers(vector<Worker>& workers, const vector<char>& open) {
+    vector<pollfd> fds;
+    vector<int> who;
+    for (int i = 0; i < workers.size(); i++) {
+        if (!open[i]) continue;
+        pollfd p;
+        p.fd = workers[i].link.fd, p.events = POLLIN, p.revents = 0;
+        fds.push_back(p);
+        who.push_back(i);
+    }
+    if (fds.empty()) return -1;
+    while (poll(fds.data(), fds.size(), -1) < 0)
+        if (errno != EINTR) return -1;
+    for (int i = 0; i < fds.size(); i++)
+        if (fds[i].revents) return who[i];
+    return -1;
+}
+
+#endif
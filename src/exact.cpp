@@ -0,0 +1,185 @@
+#include "exact.h"
+
+// Cost of the edges b closes when placed at slot, to its left and above
+double Exact::step(int slot, const Block &b) {
+    double ans = 0;
+    if (slot % N) ans += pieces->fit(cur[slot - 1], R, b);
+    if (slot >= N) ans += pieces->fit(cur[slot - N], D, b);
+    return ans;
+}
+
+void Exact::offer(const vector<Block> &layout) {
+    double c = pieces->layoutCost(layout);
+    if (c < bestCost) bestCost = c, best = layout;
+}
+
+// Row-major fill that takes the cheapest piece for every slot
+vector<Block> Exact::greedy(int first) {
+    vector<Block> layout(X);
+    uint64_t used = 1ULL << first;
+    cur[0] = layout[0] = pieces->block[first];
+    for (int slot = 1; slot < X; slot++) {
+        double bestStep = HUGE_VAL;
+        for (int p = 0; p < X; p++) {
+            if (used >> p & 1) continue;
+            for (int r = 0; r < pieces->turns(); r++) {
+                Block b = pieces->turned(p, r);
+                double c = step(slot, b);
+                if (c < bestStep) bestStep = c, layout[slot] = b;
+            }
+        }
+        cur[slot] = layout[slot];
+        used |= 1ULL << layout[slot].idx;
+    }
+    return layout;
+}
+
+// Sum of the k smallest of v
+static double smallest(vector<double> &v, int k) {
+    k = min(k, (int)v.size());
+    nth_element(v.begin(), v.begin() + k, v.end());
+    double ans = 0;
+    for (int i = 0; i < k; i++) ans += v[i];
+    return ans;
+}
+
+// Every slot from slot on still has to close its left edge (off the first
+// column) and its top edge (off the first row) with a distinct unused
+// piece, whose partner is unused or on the frontier. Read the other way,
+// every such edge starts at a distinct unused piece or at a frontier piece
+// and ends at an unused one. Each reading bounds both axes from below.
+double Exact::bound(uint64_t used, int slot) {
+    int left = 0, top = 0;
+    for (int s = slot; s < X; s++) {
+        if (s % N) left++;
+        if (s >= N) top++;
+    }
+    bool hasLeft = slot % N != 0;
+    int under = min(N, slot);  // frontier pieces with an open slot below
+    vector<double> inL, inT, outR, outD;
+    for (int p = 0; p < X; p++) {
+        if (used >> p & 1) continue;
+        double il = HUGE_VAL, it = HUGE_VAL, orr = HUGE_VAL, od = HUGE_VAL;
+        for (int q = 0; q < X; q++) {
+            if (q == p) continue;
+            if (!(used >> q & 1)) {
+                il = min(il, pairLeft[q * X + p]);
+                it = min(it, pairTop[q * X + p]);
+                orr = min(orr, pairLeft[p * X + q]);
+                od = min(od, pairTop[p * X + q]);
+            }
+        }
+        if (hasLeft) il = min(il, pairLeft[cur[slot - 1].idx * X + p]);
+        for (int k = slot - under; k < slot; k++) it = min(it, pairTop[cur[k].idx * X + p]);
+        inL.pb(il), inT.pb(it), outR.pb(orr), outD.pb(od);
+    }
+    // Edges leaving the frontier, each to its own unused piece
+    double fromLeft = 0, fromTop = 0;
+    if (hasLeft && left > 0) {
+        double m = HUGE_VAL;
+        for (int q = 0; q < X; q++)
+            if (!(used >> q & 1)) m = min(m, pairLeft[cur[slot - 1].idx * X + q]);
+        fromLeft = m;
+    }
+    for (int k = slot - under; k < slot; k++) {
+        double m = HUGE_VAL;
+        for (int q = 0; q < X; q++)
+            if (!(used >> q & 1)) m = min(m, pairTop[cur[k].idx * X + q]);
+        fromTop += m;
+    }
+    int frontierTop = min(under, top);
+    double h = max(smallest(inL, left), fromLeft + smallest(outR, left - (hasLeft && left > 0)));
+    double v = max(smallest(inT, top), (frontierTop == under ? fromTop : 0) + smallest(outD, top - frontierTop));
+    return h + v;
+}
+
+// The used pieces and the last N placed, which are all the slots from
+// here on can touch; a piece symbol and its turn take a byte each. The
+// search only ever takes the first unused piece of a symbol, so the mask
+// is the same whichever interchangeable pieces were placed.
+Exact::State Exact::state(uint64_t used, int slot) {
+    State s;
+    s.used = used;
+    s.frontier = 0;
+    for (int k = max(0, slot - N); k < slot; k++)
+        s.frontier = s.frontier << 8 | (uint64_t)(pieces->symbolOf(cur[k].idx) << 2 | cur[k].rot);
+    return s;
+}
+
+void Exact::search(int slot, uint64_t used, double cost) {
+    if (slot == X) {
+        if (cost < bestCost) bestCost = cost, best = cur;
+        return;
+    }
+    if ((++nodes & 1023) == 0 && (timed ? chrono::steady_clock::now() >= deadline : nodes >= EXACT_MAX_NODES))
+        complete = false;
+    if (!complete) return;
+
+    State key = state(used, slot);
+    double lb = bound(used, slot);
+    auto it = memo.find(key);
+    if (it != memo.end()) lb = max(lb, it->second);
+    if (cost + lb >= bestCost - EXACT_EPS) return;
+
+    // Cheapest placements first, so good layouts lower bestCost early
+    vector<pair<double, Block> > next;
+    uint64_t tried = 0;  // symbols, which are below X as well
+    for (int p = 0; p < X; p++) {
+        if (used >> p & 1) continue;
+        // One of a set of interchangeable pieces stands for all of them
+        int sym = pieces->symbolOf(p);
+        if (tried >> sym & 1) continue;
+        tried |= 1ULL << sym;
+        for (int r = 0; r < pieces->turns(); r++) {
+            // Turning the whole picture costs nothing, so piece 0 stays upright
+            if (p == 0 && r > 0) break;
+            Block b = pieces->turned(p, r);
+            next.pb(make_pair(step(slot, b), b));
+        }
+    }
+    sort(next.begin(), next.end(), [](const pair<double, Block> &a, const pair<double, Block> &b) { return a.first < b.first; });
+    for (int i = 0; i < next.size(); i++) {
+        if (cost + next[i].first >= bestCost - EXACT_EPS) break;
+        cur[slot] = next[i].second;
+        search(slot + 1, used | 1ULL << next[i].second.idx, cost + next[i].first);
+    }
+
+    // No completion below bestCost is left unexplored in this state
+    if (complete && memo.size() < EXACT_MEMO_LIMIT) {
+        double &proved = memo.insert(make_pair(key, 0.0)).first->second;
+        proved = max(proved, bestCost - cost);
+    }
+}
+
+// start, if given, is a full layout the result is never worse than
+vector<Block> Exact::solve(const vector<Block> &start) {
+    if (X > EXACT_MAX_PIECES) return vector<Block>();
+    deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(EXACT_TIME_LIMIT));
+    for (int i = 0; i < X; i++) pieces->block[i].idx = i;
+
+    pairLeft.assign((size_t)X * X, HUGE_VAL);
+    pairTop.assign((size_t)X * X, HUGE_VAL);
+    for (int q = 0; q < X; q++)
+        for (int p = 0; p < X; p++) {
+            if (q == p) continue;
+            for (int t = 0; t < pieces->turns(); t++)
+                for (int r = 0; r < pieces->turns(); r++) {
+                    Block a = pieces->turned(q, t), b = pieces->turned(p, r);
+                    pairLeft[q * X + p] = min(pairLeft[q * X + p], pieces->fit(a, R, b));
+                    pairTop[q * X + p] = min(pairTop[q * X + p], pieces->fit(a, D, b));
+                }
+        }
+
+    cur.assign(X, Block());
+    best.clear();
+    bestCost = HUGE_VAL;
+    MST mst(N, pieces);
+    if (!start.empty()) offer(start);
+    offer(mst.get_mst(pieces->height, pieces->width, 0));
+    for (int p = 0; p < X; p++) offer(greedy(p));
+    complete = true;
+    nodes = 0;
+    memo.clear();
+    search(0, 0, 0);
+    return best;
+}
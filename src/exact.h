@@ -0,0 +1,75 @@
+#ifndef EXACT_H
+#define EXACT_H
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "image.hpp"
+#include "MST_solver.h"
+
+using namespace std;
+
+#define EXACT_MAX_PIECES 64
+#define EXACT_AUTO_PIECES 16    // the largest puzzle --solver=auto sends here
+#define EXACT_TIME_LIMIT 3.0
+#define EXACT_MAX_NODES (1LL << 20)  // an untimed search's budget, about as long
+#define EXACT_MEMO_LIMIT (1 << 22)
+#define EXACT_EPS 1e-9
+
+// Branch and bound over row-major placements for small puzzles. The used
+// pieces are a 64-bit mask, so X is at most 64. The search starts from
+// the best of a given layout, the MST layout and a greedy fill from every
+// first piece, and cuts a partial layout off once its cost plus a lower
+// bound on the rest reaches the best full layout found. The bound gives
+// every open edge the cheapest score it could still get, once counted by
+// the piece it ends at and once by the piece it starts from, and keeps
+// the larger sum per axis. What is left to pay depends only on the used
+// pieces and the last N placed, so every such state remembers the least
+// remaining cost its search proved, and is skipped when met again with no
+// room under it.
+class Exact
+{
+	struct State
+	{
+		uint64_t used, frontier;
+		bool operator==(const State &o) const { return used == o.used && frontier == o.frontier; }
+	};
+	struct StateHash
+	{
+		size_t operator()(const State &s) const { return s.used * 0x9e3779b97f4a7c15ULL ^ s.frontier; }
+	};
+
+	int N, X;
+	Images* pieces;
+	vector<double> pairLeft, pairTop;  // q left of / above p, in the best turns
+	vector<Block> cur, best;
+	double bestCost;
+	bool complete;                     // false once the search was cut short
+	long long nodes;
+	chrono::steady_clock::time_point deadline;
+	unordered_map<State, double, StateHash> memo;
+
+	double step(int slot, const Block &b);
+	void offer(const vector<Block> &layout);
+	vector<Block> greedy(int first);
+	double bound(uint64_t used, int slot);
+	State state(uint64_t used, int slot);
+	void search(int slot, uint64_t used, double cost);
+
+public:
+	// A timed search stops after EXACT_TIME_LIMIT seconds, an untimed one
+	// after EXACT_MAX_NODES nodes, so its result does not depend on the
+	// machine
+	bool timed;
+
+	Exact(int n, Images * image) : N(n), X(n*n), pieces(image), bestCost(0), complete(true), nodes(0), timed(true) {}
+	vector<Block> solve(const vector<Block> &start = vector<Block>());
+	bool optimal() { return complete && !best.empty(); }
+};
+
+#endif
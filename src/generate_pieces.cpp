@@ -3,26 +3,13 @@
 #include <random>
 
 void assignMemory(int height, int width, int X) {
+    arena.allocate(X, height, width);
     block = new Block[X];
-    Block dull;
     for (int i = 0; i < X; i++) {
-        block[i].image = new Pixel*[height];
-        block[i].bins = new int[bin];
+        block[i].image = arena.piece(i);
+        block[i].width = width;
         block[i].original_idx = i;
-
-        for (int j = 0; j < 4; j++)
-            block[i].id[j] = false;
-        for (int j = 0; j < bin; j++) {
-            block[i].bins[j] = 0;
-        }
-        for (int j = 0; j < height; j++) {
-            block[i].image[j] = new Pixel[width];
-        }
     }
-    dull.image = new Pixel*[height];
-    dull.bins = new int[bin];
-    for (int j = 0; j < height; j++)
-        dull.image[j] = new Pixel[width];
 }
 
 void generateImages(cv::Mat img, int n, int height, int width) {
@@ -34,14 +21,8 @@ void generateImages(cv::Mat img, int n, int height, int width) {
         start = start * height;
         stop = stop * width;
 
-        for (int j = 0; j < height; j++) {
-            for (int k = 0; k < width; k++) {
-                cv::Vec3b pix = img.at<cv::Vec3b>(j + start, k + stop);
-                for (int h = 0; h < 3; h++) {
-                    block[i].image[j][k].val[h] = pix[h];
-                }
-            }
-        }
+        for (int j = 0; j < height; j++)
+            memcpy(block[i].at(j, 0), img.ptr<unsigned char>(j + start) + stop * 3, (size_t)width * 3);
     }
 }
 
@@ -63,7 +44,7 @@ vector<Block> permute(int n, int seed) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2 && argc != 5) {
+    if (argc != 2 && argc != 5 && !(argc == 6 && string(argv[5]) == "--rotate")) {
         std::cerr << "No file name found. Please pass a file name as a parameter." << std::endl;
         exit(1);
     }
@@ -77,8 +58,9 @@ int main(int argc, char* argv[]) {
     int height, width, n, len;
     string dir = "./generated_pieces";
     int seed = time(0);
+    bool rotate = argc == 6;
     std::cout << "Image dimensions: " << img.rows << " " << img.cols << std::endl;
-    if (argc == 5) {
+    if (argc >= 5) {
         len = std::stoi(argv[2]);
         dir = argv[3];
         seed = std::stoi(argv[4]);
@@ -104,24 +86,29 @@ int main(int argc, char* argv[]) {
     generateImages(img, n, height, width);
 
     vector<Block> permuted = permute(n * n, seed);
+    // Turns come from their own stream so the permutation stays the same
+    std::default_random_engine turns(seed + 1);
+    std::uniform_int_distribution<int> quarter(0, 3);
     std::ofstream metadataFile(dir + "original_positions.txt");
 
     for (int i = 0; i < n * n; i++) {
 
         cv::Mat pieceImg = cv::Mat::zeros(height, width, CV_8UC3);
         string fileid = std::to_string(i + 1) + ".jpg";
-        for (int j = 0; j < height; j++) {
-            for (int k = 0; k < width; k++) {
-                // Access the pixel values from permuted[i].image[j][k]
-                Pixel& pixel = permuted[i].image[j][k];
-                // Assign individual color channel values to cv::Vec3b
-                pieceImg.at<cv::Vec3b>(j, k) = cv::Vec3b(pixel.val[0], pixel.val[1], pixel.val[2]);
-            }
-        }
+        for (int j = 0; j < height; j++)
+            memcpy(pieceImg.ptr<unsigned char>(j), permuted[i].at(j, 0), (size_t)width * 3);
+
+        // Quarter turns clockwise, recorded as a third metadata field
+        int rot = rotate ? quarter(turns) : 0;
+        if (rot == 1) cv::rotate(pieceImg, pieceImg, cv::ROTATE_90_CLOCKWISE);
+        else if (rot == 2) cv::rotate(pieceImg, pieceImg, cv::ROTATE_180);
+        else if (rot == 3) cv::rotate(pieceImg, pieceImg, cv::ROTATE_90_COUNTERCLOCKWISE);
 
         std::string fullPath = dir + fileid;
         cv::imwrite(fullPath, pieceImg);
-        metadataFile << i + 1 << "," << permuted[i].original_idx << std::endl;
+        metadataFile << i + 1 << "," << permuted[i].original_idx;
+        if (rotate) metadataFile << "," << rot;
+        metadataFile << std::endl;
         printf("Generated %s\n", fileid.c_str());
     }
 
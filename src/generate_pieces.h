@@ -23,6 +23,7 @@ using namespace std;
 #define pb push_back
 #define bin 10
 
+PieceArena arena;
 Block* block;
 void generateImages(cv::Mat img, int n, int height, int width);
 void assignMemory(int height,int width,int X);
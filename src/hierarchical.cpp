@@ -0,0 +1,216 @@
+#include "hierarchical.h"
+#include <thread>
+
+// Without a store the lists come from a bounded search over the edge
+// descriptors, or from the edge index, rather than from a full row of scores
+void Hierarchical::buildCandidates() {
+    cand.assign((size_t)X * 4 * CANDIDATES, -1);
+    int k = min(CANDIDATES, X - 1);
+    auto work = [&](int from, int to) {
+        vector<pair<double, int> > row;
+        for (int p = from; p < to; p++) {
+            for (int d = 0; d < 4; d++) {
+                if (pieces->sparse) {
+                    pieces->candidates(p, d, k, row);
+                    for (int i = 0; i < row.size(); i++) cand[((size_t)p * 4 + d) * CANDIDATES + i] = row[i].second;
+                    continue;
+                }
+                row.clear();
+                for (int q = 0; q < X; q++)
+                    if (q != p) row.pb(make_pair(pieces->adj(p, d, q), q));
+                partial_sort(row.begin(), row.begin() + k, row.end());
+                for (int i = 0; i < k; i++) cand[((size_t)p * 4 + d) * CANDIDATES + i] = row[i].second;
+            }
+        }
+    };
+    if (pieces->workers > 1) {
+        // One range of pieces per worker process, returned as raw list rows
+        size_t row = 4 * CANDIDATES * sizeof(int);
+        auto compute = [&](int lo, int hi) {
+            work(lo, hi);
+            const char* at = (const char*)cand.data();
+            return vector<char>(at + lo * row, at + hi * row);
+        };
+        auto apply = [&](int lo, int hi, const vector<char>& shard) {
+            memcpy((char*)cand.data() + lo * row, shard.data(), (hi - lo) * row);
+        };
+        if (runSharded(pieces->workers, X, compute, apply)) return;
+        cerr << "Candidate workers failed, searching in this process" << endl;
+    }
+    int threads = max(1u, thread::hardware_concurrency());
+    vector<thread> pool;
+    int chunk = (X + threads - 1) / threads;
+    for (int i = 1; i < threads && i * chunk < X; i++)
+        pool.pb(thread(work, i * chunk, min(X, (i + 1) * chunk)));
+    work(0, min(X, chunk));
+    for (int i = 0; i < pool.size(); i++) pool[i].join();
+}
+
+// Grows segments along best-buddy links; a piece joins only if it is the
+// mutual best buddy of every neighbour already in the segment, and no
+// segment outgrows the N x N frame.
+void Hierarchical::buildSegments() {
+    if (pieces->sparse) {
+        // The first candidate is the best match, so mutual best buddies
+        // can be read off the lists
+        for (int d = 0; d < 4; d++) bb[d].assign(X, -1);
+        for (int p = 0; p < X; p++)
+            for (int d = 0; d < 4; d++) {
+                int q = cand[((size_t)p * 4 + d) * CANDIDATES];
+                if (q != -1 && cand[((size_t)q * 4 + 3 - d) * CANDIDATES] == p) bb[d][p] = q;
+            }
+    } else {
+        pieces->bestBuddies(bb[L], bb[R], bb[T], bb[D]);
+    }
+    seg.assign(X, -1);
+    local.assign(X, pii(0, 0));
+    members.clear();
+
+    for (int s = 0; s < X; s++) {
+        if (seg[s] != -1) continue;
+        int id = members.size();
+        members.pb(vector<int>(1, s));
+        seg[s] = id;
+        map<pii, int> cells;
+        cells[pii(0, 0)] = s;
+        int minr = 0, maxr = 0, minc = 0, maxc = 0;
+        queue<int> Q;
+        Q.push(s);
+        while (!Q.empty()) {
+            int p = Q.front();
+            Q.pop();
+            for (int d = 0; d < 4; d++) {
+                int q = bb[d][p];
+                if (q == -1 || seg[q] != -1) continue;
+                pii c(local[p].first + sideRow[d], local[p].second + sideCol[d]);
+                if (cells.count(c)) continue;
+                if (max(maxr, c.first) - min(minr, c.first) >= N) continue;
+                if (max(maxc, c.second) - min(minc, c.second) >= N) continue;
+                bool agree = true;
+                for (int e = 0; e < 4 && agree; e++) {
+                    map<pii, int>::iterator it = cells.find(pii(c.first + sideRow[e], c.second + sideCol[e]));
+                    if (it != cells.end() && bb[e][q] != it->second) agree = false;
+                }
+                if (!agree) continue;
+                cells[c] = q;
+                seg[q] = id;
+                local[q] = c;
+                members[id].pb(q);
+                minr = min(minr, c.first), maxr = max(maxr, c.first);
+                minc = min(minc, c.second), maxc = max(maxc, c.second);
+                Q.push(q);
+            }
+        }
+    }
+}
+
+vector<Block> Hierarchical::solve() {
+    buildCandidates();
+    buildSegments();
+    return assemble();
+}
+
+vector<Block> Hierarchical::solveFrom(const vector<int> &segments, const vector<pii> &offsets,
+                                      const vector<vector<int> > &groups, const vector<int> &candidates) {
+    seg = segments;
+    local = offsets;
+    members = groups;
+    cand = candidates;
+    return assemble();
+}
+
+vector<Block> Hierarchical::assemble() {
+    vector<pii> cood(X, pii(INF, INF));
+    map<pii, int> grid;
+    int minr = INF, maxr = -INF, minc = INF, maxc = -INF;
+    priority_queue<edges> Q;
+
+    placed.assign(members.size(), 0);
+    // Places segment s shifted by (sr, sc) and queues its open sides
+    auto place = [&](int s, int sr, int sc) {
+        placed[s] = 1;
+        for (int i = 0; i < members[s].size(); i++) {
+            int m = members[s][i];
+            pii c(local[m].first + sr, local[m].second + sc);
+            cood[m] = c;
+            grid[c] = m;
+            minr = min(minr, c.first), maxr = max(maxr, c.first);
+            minc = min(minc, c.second), maxc = max(maxc, c.second);
+        }
+        for (int i = 0; i < members[s].size(); i++) {
+            int m = members[s][i];
+            for (int d = 0; d < 4; d++) {
+                if (grid.count(pii(cood[m].first + sideRow[d], cood[m].second + sideCol[d]))) continue;
+                for (int k = 0; k < CANDIDATES; k++) {
+                    int q = cand[((size_t)m * 4 + d) * CANDIDATES + k];
+                    if (q != -1 && cood[q].first == INF) Q.push(edges(m, q, d, pieces->adj(m, d, q)));
+                }
+            }
+        }
+    };
+
+    int largest = 0;
+    for (int s = 1; s < members.size(); s++)
+        if (members[s].size() > members[largest].size()) largest = s;
+    place(largest, 0, 0);
+
+    while (!Q.empty()) {
+        edges e = Q.top();
+        Q.pop();
+        if (cood[e.j].first != INF) continue;
+        int d = e.id & 3;
+        pii target(cood[e.i].first + sideRow[d], cood[e.i].second + sideCol[d]);
+        if (grid.count(target)) continue;
+
+        int s = seg[e.j];
+        int sr = target.first - local[e.j].first, sc = target.second - local[e.j].second;
+        bool fits = true;
+        int r0 = minr, r1 = maxr, c0 = minc, c1 = maxc;
+        double contact = 0;
+        int contacts = 0;
+        for (int i = 0; i < members[s].size() && fits; i++) {
+            int m = members[s][i];
+            pii c(local[m].first + sr, local[m].second + sc);
+            if (grid.count(c)) fits = false;
+            r0 = min(r0, c.first), r1 = max(r1, c.first);
+            c0 = min(c0, c.second), c1 = max(c1, c.second);
+            // Boundary compatibility of the whole segment with the layout
+            for (int f = 0; f < 4; f++) {
+                map<pii, int>::iterator it = grid.find(pii(c.first + sideRow[f], c.second + sideCol[f]));
+                if (it != grid.end()) contact += pieces->adj(m, f, it->second), contacts++;
+            }
+        }
+        if (!fits || r1 - r0 >= N || c1 - c0 >= N) continue;
+
+        // Re-queue once with the mean boundary score so that large
+        // segments are not judged by a single contact
+        double mean = contacts ? contact / contacts : e.weight;
+        if (e.id < 4 && mean > e.weight) {
+            Q.push(edges(e.i, e.j, e.id + 4, mean));
+            continue;
+        }
+        place(s, sr, sc);
+    }
+
+    // Anything left over is placed greedily around the assembled frame
+    vector<Block> ans(X);
+    vector<char> used(X, 0);
+    for (int i = 0; i < X; i++) ans[i] = pieces->dull, ans[i].idx = -1;
+    for (int i = 0; i < X; i++) {
+        if (cood[i].first == INF) continue;
+        int r = cood[i].first - minr, c = cood[i].second - minc;
+        ans[r * N + c] = pieces->block[i];
+        used[i] = 1;
+    }
+    MST mst(N, pieces);
+    mst.fill_greedy(ans, used);
+    return ans;
+}
+
+// Pieces inside multi-piece segments that were placed whole; refinement
+// only works on the seams and on the pieces the greedy fill scattered
+vector<char> Hierarchical::lockedPieces() {
+    vector<char> ans(X, 0);
+    for (int i = 0; i < X; i++) ans[i] = members[seg[i]].size() > 1 && placed[seg[i]];
+    return ans;
+}
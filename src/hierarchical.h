@@ -0,0 +1,52 @@
+#ifndef HIERARCHICAL_H
+#define HIERARCHICAL_H
+
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <queue>
+#include <map>
+
+#include "image.hpp"
+#include "MST_solver.h"
+
+using namespace std;
+
+#define CANDIDATES 4
+#define HIERARCHICAL_MIN_PIECES 4096
+
+// Solver for very large puzzles. Pieces that are mutual best buddies with
+// every placed neighbour are first locked into segments; the segments are
+// then assembled like super-pieces, Prim style, by the compatibility along
+// their whole contact boundary, and the leftovers are filled greedily.
+// The segment level is not handed to the GA or the MST solver: both place
+// one cell per slot of an N x N frame, while segments are irregular shapes
+// of any size, so assemble() grows the frame the way the MST solver does
+// but one segment at a time, and reuses the MST's greedy fill for the rest.
+// solveFrom assembles segments and candidates that were built elsewhere.
+class Hierarchical
+{
+	int N, X;
+	Images* pieces;
+	vector<int> bb[4];           // mutual best buddy per side (R, T, D, L)
+	vector<int> cand;            // CANDIDATES best matches per piece and side
+	vector<int> seg;             // segment of each piece
+	vector<pii> local;           // offset of each piece inside its segment
+	vector<vector<int> > members;
+	vector<char> placed;         // segments assemble() placed whole
+
+	void buildCandidates();
+	void buildSegments();
+	vector<Block> assemble();
+
+public:
+	Hierarchical(int n, Images * image) : N(n), X(n*n), pieces(image) {}
+	int segments() { return members.size(); }
+	vector<Block> solveFrom(const vector<int> &segments, const vector<pii> &offsets,
+	                        const vector<vector<int> > &groups, const vector<int> &candidates);
+	vector<char> lockedPieces();
+	vector<Block> solve();
+};
+
+#endif
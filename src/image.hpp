@@ -12,10 +12,20 @@
 #include <fstream>
 #include <cmath>
 #include <unordered_map>
+#include <map>
+#include <thread>
+#include <atomic>
 #include <opencv2/highgui.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "compat.hpp"
+#include "arena.hpp"
+#include "descriptors.hpp"
+#include "ann.hpp"
+#include "distributed.hpp"
+#include "pipeline.hpp"
+
 using namespace std;
 #define pb push_back
 #define bin 10
@@ -27,76 +37,208 @@ using namespace std;
 #define L 3
 #define INF 1000000000
 #define TIME_LIMIT 15.0
+#define QUEUE_DEPTH 64
+#define INITIAL_CAPACITY 64
 
 typedef std::pair<int,int> pii;
 typedef std::pair<pii,int> ppi;
 
-struct Pixel {
-    float val[3]; // Assuming this is for color images; adjust as needed
-};
+// Row and column offsets of the R, T, D, L sides; side 3-d faces side d
+static const int sideRow[4] = {0, -1, 1, 0};
+static const int sideCol[4] = {1, 0, 0, -1};
 
+// Lightweight handle to a piece whose pixels live in a PieceArena. rot is
+// the number of quarter turns clockwise the piece is placed with, and
+// original_rot the number the generator turned it by, if known.
 struct Block {
-    Pixel** image;
-    bool id[4];
-    int neigh[4];
-    int* bins;
+    unsigned char* image;
+    int width;
     int idx;
     int original_idx;
+    int rot;
+    int original_rot;
+
+    Block() : image(nullptr), width(0), idx(-1), original_idx(-1), rot(0), original_rot(0) {}
+    unsigned char* at(int j, int k) const { return image + ((size_t)j * width + k) * 3; }
+
+    // Pixel (j, k) of the piece as placed; turned pieces are square
+    unsigned char* turnedAt(int j, int k) const {
+        switch (rot & 3) {
+            case 1: return at(width - 1 - k, j);
+            case 2: return at(width - 1 - j, width - 1 - k);
+            case 3: return at(k, width - 1 - j);
+            default: return at(j, k);
+        }
+    }
 };
 
 class Images {
 public:
-    vector<vector<double>> adjl, adjr, adjt, adjd;
+    CompatStore compat;
+    SideCompat sides;
+    Precision precision;
+    bool cache;
+    bool pipeline;
+    bool rotations;
+    bool sparse;
+    bool ann;
+    int workers;  // processes that score the store, 1 scores in place
+    bool classes;
+    double classTolerance;  // mean squared difference per value within a class
+    vector<int> edgeClass[4];  // class of every piece side, by R, T, D, L
+    vector<int> classRep[4];   // a piece of every class
+    vector<int> symbol;        // pieces with the same class on all sides share one
+    PieceArena arena;
+    EdgeDescriptors desc;
+    EdgeIndex index;
     Block* block;
     Block dull;
     int height, width;
     int N, X;
+    int capacity;
 
-    Images() : block(nullptr), N(0), X(0), height(0), width(0) {}
+    Images() : block(nullptr), N(0), X(0), capacity(0), height(0), width(0), precision(PRECISION_FLOAT), cache(false), pipeline(false), rotations(false), sparse(false), ann(false), workers(1), classes(false), classTolerance(0) {}
 
-    void loadImages(string dir) {
+    // adjl(i,j): j placed left of i, adjt(i,j): j placed above i.
+    // adjr and adjd are the transposed views of the same data. Sparse
+    // puzzles keep no store and score from the edge descriptors instead.
+    double adjl(int i, int j) const { return sparse ? SSD_left(i, j) : compat.get(AXIS_H, i, j); }
+    double adjr(int i, int j) const { return sparse ? SSD_left(j, i) : compat.get(AXIS_H, j, i); }
+    double adjt(int i, int j) const { return sparse ? SSD_top(i, j) : compat.get(AXIS_V, i, j); }
+    double adjd(int i, int j) const { return sparse ? SSD_top(j, i) : compat.get(AXIS_V, j, i); }
+
+    // j placed on side d of i, both upright
+    double adj(int i, int d, int j) const {
+        switch (d) {
+            case R: return adjr(i, j);
+            case T: return adjt(i, j);
+            case D: return adjd(i, j);
+            default: return adjl(i, j);
+        }
+    }
+
+    // Dissimilarity of b placed on side d of a, both turned by their rot.
+    // Without rotations this is one of the views above. A sparse score
+    // may stop short once it reaches bound.
+    double fit(const Block& a, int d, const Block& b, double bound = HUGE_VAL) const {
+        if (sparse)
+            return (double)desc.facing(a.idx, turnedSide(d, a.rot), b.idx, turnedSide(3 - d, b.rot), bound >= (double)LLONG_MAX ? LLONG_MAX : (long long)ceil(bound));
+        if (rotations)
+            return sides.get(4 * a.idx + turnedSide(d, a.rot), 4 * b.idx + turnedSide(3 - d, b.rot));
+        return adj(a.idx, d, b.idx);
+    }
+
+    // Interchangeable pieces have the same symbol; every piece is its own
+    // without edge classes
+    int symbolOf(int i) const { return symbol.empty() ? i : symbol[i]; }
+
+    // Orientations a piece may be placed in, and piece i in one of them
+    int turns() const { return rotations ? 4 : 1; }
+    Block turned(int i, int r) const {
+        Block b = block[i];
+        b.rot = r;
+        return b;
+    }
+
+    void loadMetadata(string dir) {
         std::unordered_map<int, int> originalIndices; // Map scrambled index to original index
+        std::unordered_map<int, int> originalRotations;
         std::ifstream metadataFile(dir + "original_positions.txt");
         std::string line;
         while (std::getline(metadataFile, line)) {
             std::istringstream iss(line);
-            int scrambledIndex, originalIndex;
+            int scrambledIndex, originalIndex, rotation;
             char separator; // To consume the comma separator
             if (iss >> scrambledIndex >> separator && separator == ',' && iss >> originalIndex) {
                 originalIndices[scrambledIndex] = originalIndex;
+                // Turned pieces carry the generator's rotation as a third field
+                if (iss >> separator && separator == ',' && iss >> rotation)
+                    originalRotations[scrambledIndex] = rotation;
             }
         }
         metadataFile.close();
 
         for (int i = 0; i < X; i++) {
-            std::string filename = dir + std::to_string(i + 1) + ".jpg";
-            cv::Mat img = cv::imread(filename);
-            if (img.empty()) {
-                std::cerr << "Error loading: " << filename << std::endl;
-                continue;
-            }
-
             // Retrieve the original index using the scrambled index (i + 1)
             if (originalIndices.find(i + 1) != originalIndices.end()) {
                 block[i].original_idx = originalIndices[i + 1];
+                if (originalRotations.count(i + 1)) block[i].original_rot = originalRotations[i + 1];
             } else {
                 std::cerr << "Original index for piece " << i + 1 << " not found in metadata." << std::endl;
-                continue;
             }
+        }
+    }
 
-            block[i].idx = i; // Assuming 'idx' needs to be the index in the scrambled sequence
-            for (int j = 0; j < height; j++) {
-                for (int k = 0; k < width; k++) {
-                    cv::Vec3b pix = img.at<cv::Vec3b>(j, k);
-                    for (int h = 0; h < 3; h++) {
-                        block[i].image[j][k].val[h] = pix[h];
-                    }
-                }
-            }
+    cv::Mat decodePiece(string dir, int i) {
+        std::string filename = dir + std::to_string(i + 1) + ".jpg";
+        cv::Mat img = cv::imread(filename);
+        if (img.empty()) {
+            std::cerr << "Error loading: " << filename << std::endl;
+        } else if (img.rows != height || img.cols != width) {
+            std::cerr << "Piece " << filename << " is not " << height << "x" << width << std::endl;
+            img = cv::Mat();
         }
+        return img;
+    }
+
+    // Copies a decoded piece into the arena and cuts out its edge strips
+    void storePiece(int i, const cv::Mat& img) {
+        if (!img.empty()) {
+            for (int j = 0; j < height; j++)
+                memcpy(block[i].at(j, 0), img.ptr<unsigned char>(j), (size_t)width * 3);
+        }
+        desc.extract(i, block[i].image);
+    }
+
+    void loadImages(string dir) {
+        loadMetadata(dir);
+        for (int i = 0; i < X; i++)
+            storePiece(i, decodePiece(dir, i));
     }
 
+    // Decoding threads feed descriptor extraction through a bounded queue,
+    // and each piece's compatibility rows are scored against every piece
+    // that was ready before it as soon as it arrives, so slow storage and
+    // scoring overlap. With scores false only the pixels are loaded.
+    void loadPipelined(string dir, bool scores) {
+        loadMetadata(dir);
+        int threads = max(1u, thread::hardware_concurrency());
+        // Decoding is mostly waiting on storage, so oversubscribe it
+        int decoders = max(4, 2 * threads);
+        BoundedQueue<pair<int, cv::Mat> > decoded(QUEUE_DEPTH);
+        BoundedQueue<int> ready(X > 0 ? X : 1);
+        vector<int> order(X);
+        atomic<int> next(0), running(decoders);
 
+        vector<thread> pool;
+        for (int t = 0; t < decoders; t++) {
+            pool.pb(thread([&]() {
+                for (int i = next++; i < X; i = next++)
+                    decoded.push(make_pair(i, decodePiece(dir, i)));
+                if (--running == 0) decoded.close();
+            }));
+        }
+        pool.pb(thread([&]() {
+            pair<int, cv::Mat> item;
+            int rank = 0;
+            while (decoded.pop(item)) {
+                storePiece(item.first, item.second);
+                order[rank] = item.first;
+                ready.push(rank++);
+            }
+            ready.close();
+        }));
+        for (int t = 0; scores && t < threads; t++) {
+            pool.pb(thread([&]() {
+                int rank;
+                while (ready.pop(rank)) {
+                    int i = order[rank];
+                    for (int k = 0; k < rank; k++) scorePair(i, order[k]);
+                }
+            }));
+        }
+        for (int t = 0; t < pool.size(); t++) pool[t].join();
+    }
     vector<Block> getScrambledImage() {
         vector<Block> v;
         for (int i = 0; i < X; i++) v.pb(block[i]);
@@ -110,6 +252,10 @@ public:
             cerr << "Failed to load image: " << firstImageFilename << endl;
             return;
         }
+        if (rotations && firstImg.rows != firstImg.cols) {
+            cerr << "Pieces of unknown orientation must be square" << endl;
+            exit(1);
+        }
 
         if (givenN > 0) {
             N = givenN;
@@ -122,19 +268,119 @@ public:
         X = N * N;
         initializeVector(X);
         assignMemory();
-        loadImages(dir);
-        insertInTopMatrix();
-        insertInLeftMatrix();
+        desc.init(X, height, width, limit);
+
+        // Reuse the scores of an earlier run on the same pieces if asked to
+        string cachePath = dir + "compat.cache";
+        if (pipeline) {
+            // Scoring while loading is wasted work if a cache may match
+            struct stat st;
+            bool scores = !sparse && workers <= 1 && !classes && !(cache && stat(cachePath.c_str(), &st) == 0);
+            loadPipelined(dir, scores);
+            if (scores) {
+                if (cache && !compat.save(cachePath, cacheKey()))
+                    cerr << "Failed to write " << cachePath << endl;
+                return;
+            }
+        } else {
+            loadImages(dir);
+        }
+        if (classes) buildClasses();
+        if (sparse) {
+            if (ann) index.build(desc);
+            return;
+        }
+        if (rotations) {
+            if (workers <= 1 || !scoreSharded()) insertSidePairs();
+            return;
+        }
+        uint64_t key = cacheKey();
+        if (cache && compat.load(cachePath, key)) return;
+        if (classes) scoreClasses();
+        else if (workers <= 1 || !scoreSharded()) {
+            insertInTopMatrix();
+            insertInLeftMatrix();
+        }
+        if (cache && !compat.save(cachePath, key))
+            cerr << "Failed to write " << cachePath << endl;
+    }
+
+    // Identifies the piece content and every setting the scores depend on
+    uint64_t cacheKey() {
+        int config[5] = {X, height, width, limit, (int)precision};
+        uint64_t h = hashBytes(HASH_SEED, config, sizeof(config));
+        for (int i = 0; i < X; i++)
+            h = hashBytes(h, arena.piece(i), arena.pieceBytes());
+        // Scores shared within a class are only exact without tolerance
+        if (classes) h = hashBytes(h, &classTolerance, sizeof(classTolerance));
+        return h;
     }
 
+    double maxScore() {
+        return 3.0 * 255 * 255 * limit * max(height, width);
+    }
+
+    // Turned pieces are scored per pair of sides instead of per axis;
+    // sparse puzzles have no store at all
     void initializeVector(int n) {
-        adjl.resize(n, vector<double>(n));
-        adjr.resize(n, vector<double>(n));
-        adjt.resize(n, vector<double>(n));
-        adjd.resize(n, vector<double>(n));
+        if (sparse) return;
+        if (rotations) sides.init(n, precision, maxScore());
+        else compat.init(n, precision, maxScore());
+    }
+
+    // Starts an empty puzzle that grows one piece at a time through
+    // addPiece; N stays 0 until the caller knows the final size.
+    void beginIncremental(int h, int w) {
+        height = h;
+        width = w;
+        N = X = 0;
+        capacity = INITIAL_CAPACITY;
+        arena.allocate(capacity, height, width);
+        block = new Block[capacity];
+        desc.init(capacity, height, width, limit);
+        compat.init(0, precision, maxScore(), capacity);
+    }
+
+    // Appends a piece and scores only its new row and column on each axis
+    int addPiece(const cv::Mat& img) {
+        if (X == capacity) reserve(2 * capacity);
+        int i = X++;
+        block[i].image = arena.piece(i);
+        block[i].width = width;
+        block[i].idx = i;
+        compat.grow(X);
+        storePiece(i, img);
+        for (int j = 0; j < i; j++) scorePair(i, j);
+        return i;
+    }
+
+    void reserve(int n) {
+        arena.grow(n);
+        Block* next = new Block[n];
+        for (int i = 0; i < X; i++) {
+            next[i] = block[i];
+            next[i].image = arena.piece(i);
+        }
+        delete[] block;
+        block = next;
+        desc.grow(n);
+        capacity = n;
     }
 
-    double getWeight(vector<Block>& c, int k, Block b) {
+    // Total dissimilarity of an N x N layout over its right and down
+    // adjacencies; every solver scores whole layouts with this
+    double layoutCost(const vector<Block>& c) const {
+        double ans = 0;
+        for (int i = 0; i < X; i++) {
+            if ((i + 1) % N != 0) ans += fit(c[i], R, c[i + 1]);
+            if (i + N < X) ans += fit(c[i], D, c[i + N]);
+        }
+        return ans;
+    }
+
+    // Summing stops once the weight reaches bound, the best one so far in
+    // an argmin; the partial sum returned is then at least bound
+    double getWeight(vector<Block>& c, int k, Block b, double bound = HUGE_VAL) {
         double ans = 0;
         int a = k / N, bb = k % N;
 
@@ -142,6 +388,7 @@ public:
         // Up, Right, Down, Left
         int dx[4] = {0, 1, 0, -1};
         int dy[4] = {1, 0, -1, 0};
+        int side[4] = {R, D, L, T};
 
         for (int i = 0; i < 4; i++) {
             int a1 = a + dx[i];
@@ -153,69 +400,258 @@ public:
             int adjIndex = a1 * N + b1;
             if (c[adjIndex].idx == -1) continue;
 
-            // Use a switch case or if-else to apply the correct adjacency based on direction
-            switch (i) {
-                case 0: ans += adjr[b.idx][c[adjIndex].idx]; break; // Right
-                case 1: ans += adjd[b.idx][c[adjIndex].idx]; break; // Down
-                case 2: ans += adjl[b.idx][c[adjIndex].idx]; break; // Left
-                case 3: ans += adjt[b.idx][c[adjIndex].idx]; break; // Up
-            }
+            // Apply the correct adjacency based on direction
+            ans += fit(b, side[i], c[adjIndex], bound - ans);
+            if (ans >= bound) break;
         }
         return ans;
     }
 
 
-    void assignMemory() {
-        block = new Block[X];
+    // Mutual best matches: bl[i] is the piece that fits best left of i
+    // while i fits best right of it, and so on; -1 where there is none.
+    void bestBuddies(vector<int>& bl, vector<int>& br, vector<int>& bt, vector<int>& bd) {
+        bl.assign(X, -1);
+        br.assign(X, -1);
+        bt.assign(X, -1);
+        bd.assign(X, -1);
+
+        vector<int> l(X, -1), r(X, -1), t(X, -1), d(X, -1);
+        for (int i = 0; i < X; i++)
+            for (int k = 0; k < X; k++) if (k != i) {
+                if (l[i] == -1 || adjl(i, k) < adjl(i, l[i])) l[i] = k;
+                if (r[i] == -1 || adjr(i, k) < adjr(i, r[i])) r[i] = k;
+                if (t[i] == -1 || adjt(i, k) < adjt(i, t[i])) t[i] = k;
+                if (d[i] == -1 || adjd(i, k) < adjd(i, d[i])) d[i] = k;
+            }
+
         for (int i = 0; i < X; i++) {
-            block[i].image = new Pixel*[height];
-            for (int j = 0; j < height; j++) {
-                block[i].image[j] = new Pixel[width];
+            int j = l[i];
+            if (j != -1 && r[j] == i) bl[i] = j, br[j] = i;
+            j = t[i];
+            if (j != -1 && d[j] == i) bt[i] = j, bd[j] = i;
+        }
+    }
+
+    // Mutual best matches between piece sides: buddy[4*i+s] is 4*j+t when
+    // side t of j fits side s of i best and the other way round, -1
+    // otherwise. Without rotations only opposite sides can meet.
+    void sideBuddies(vector<int>& buddy) {
+        buddy.assign(4 * X, -1);
+        if (!rotations) {
+            vector<int> bl, br, bt, bd;
+            bestBuddies(bl, br, bt, bd);
+            for (int i = 0; i < X; i++) {
+                if (bl[i] != -1) buddy[4 * i + L] = 4 * bl[i] + R;
+                if (br[i] != -1) buddy[4 * i + R] = 4 * br[i] + L;
+                if (bt[i] != -1) buddy[4 * i + T] = 4 * bt[i] + D;
+                if (bd[i] != -1) buddy[4 * i + D] = 4 * bd[i] + T;
             }
-            block[i].bins = new int[bin];
-            std::fill_n(block[i].bins, bin, 0);
-            std::fill_n(block[i].id, 4, false);
+            return;
+        }
+        vector<int> best(4 * X, -1);
+        for (int u = 0; u < 4 * X; u++)
+            for (int v = 0; v < 4 * X; v++)
+                if (v / 4 != u / 4 && (best[u] == -1 || sides.get(u, v) < sides.get(u, best[u]))) best[u] = v;
+        for (int u = 0; u < 4 * X; u++)
+            if (best[u] != -1 && best[best[u]] == u) buddy[u] = best[u];
+    }
+
+    // The k pieces that fit best on side d of i, best first. Most pairs are
+    // rejected on the coarse edge summaries against the current k-th best,
+    // and the rest are only summed until they exceed it.
+    void bestMatches(int i, int d, int k, vector<pair<double, int> >& out) const {
+        priority_queue<pair<double, int> > best;  // worst kept match on top
+        for (int j = 0; j < X; j++) {
+            if (j == i) continue;
+            bool full = (int)best.size() == k;
+            double bound = full ? best.top().first : HUGE_VAL;
+            if (full && desc.coarseBound(i, d, j, 3 - d) >= bound) continue;
+            double v = (double)desc.facing(i, d, j, 3 - d, full ? (long long)bound : LLONG_MAX);
+            if (full && v >= bound) continue;
+            best.push(make_pair(v, j));
+            if ((int)best.size() > k) best.pop();
         }
-        dull.image = new Pixel*[height];
-        for (int j = 0; j < height; j++) {
-            dull.image[j] = new Pixel[width];
+        out.resize(best.size());
+        for (int n = (int)best.size() - 1; n >= 0; n--) {
+            out[n] = best.top();
+            best.pop();
         }
-        dull.bins = new int[bin];
-        std::fill_n(dull.bins, bin, 0);
     }
 
+    // Candidate lists for sparse puzzles, from the index if there is one
+    void candidates(int i, int d, int k, vector<pair<double, int> >& out) const {
+        if (ann) index.matches(desc, i, d, k, out);
+        else bestMatches(i, d, k, out);
+    }
 
-    double SSD_left(const Block& sure, const Block& trial) {
-        double ssd = 0.0;
-        for (int i = 0; i < height; ++i) {
-            for (int j = 0; j < limit; ++j) {
-                for (int h = 0; h < 3; ++h) {
-                    ssd += std::pow(sure.image[i][j].val[h] - trial.image[i][width - 1 - j].val[h], 2);
-                }
+    // Share of the exact top k that the index also returns, over up to
+    // `samples` piece sides spread evenly through the puzzle
+    double indexRecall(int samples, int k) const {
+        int sides = 4 * X;
+        int step = max(1, sides / samples);
+        long long found = 0, total = 0;
+        vector<pair<double, int> > exact, approx;
+        for (int u = 0; u < sides; u += step) {
+            bestMatches(u / 4, u % 4, k, exact);
+            index.matches(desc, u / 4, u % 4, k, approx);
+            for (int a = 0; a < exact.size(); a++) {
+                total++;
+                for (int b = 0; b < approx.size(); b++)
+                    if (approx[b].second == exact[a].second) {
+                        found++;
+                        break;
+                    }
             }
         }
-        return ssd;
+        return total ? (double)found / total : 1.0;
+    }
+
+    void assignMemory() {
+        arena.allocate(X, height, width);
+        block = new Block[X];
+        capacity = X;
+        for (int i = 0; i < X; i++) {
+            block[i].image = arena.piece(i);
+            block[i].width = width;
+            block[i].idx = i; // Assuming 'idx' needs to be the index in the scrambled sequence
+        }
     }
 
-    double SSD_top(const Block& sure, const Block& trial) {
-        double ssd = 0.0;
-        for (int i = 0; i < limit; ++i) {
-            for (int j = 0; j < width; ++j) {
-                for (int h = 0; h < 3; ++h) {
-                    ssd += std::pow(sure.image[i][j].val[h] - trial.image[height - 1 - i][j].val[h], 2);
+
+    // Left edge of sure against the right edge of trial
+    double SSD_left(int sure, int trial) const {
+        return (double)desc.facing(sure, L, trial, R);
+    }
+
+    // Top edge of sure against the bottom edge of trial
+    double SSD_top(int sure, int trial) const {
+        return (double)desc.facing(sure, T, trial, D);
+    }
+
+    // Both orders of a pair on both axes, or every pair of their sides
+    void scorePair(int i, int j) {
+        if (rotations) {
+            for (int s = 0; s < 4; s++)
+                for (int t = 0; t < 4; t++)
+                    sides.set(4 * i + s, 4 * j + t, (double)desc.facing(i, s, j, t));
+            return;
+        }
+        compat.set(AXIS_H, i, j, SSD_left(i, j));
+        compat.set(AXIS_H, j, i, SSD_left(j, i));
+        compat.set(AXIS_V, i, j, SSD_top(i, j));
+        compat.set(AXIS_V, j, i, SSD_top(j, i));
+    }
+
+    // Scores the store in worker processes, each over a range of rows.
+    // Fixed pieces send both axes of their rows, turned ones every side
+    // pair against the pieces before them. False if the workers failed,
+    // with the store left for the caller to fill.
+    bool scoreSharded() {
+        auto compute = [this](int lo, int hi) {
+            vector<float> v;
+            for (int i = lo; i < hi; i++) {
+                if (rotations) {
+                    for (int j = 0; j < i; j++)
+                        for (int s = 0; s < 4; s++)
+                            for (int t = 0; t < 4; t++) v.pb((float)desc.facing(i, s, j, t));
+                    continue;
+                }
+                for (int j = 0; j < X; j++) v.pb(i == j ? 0 : (float)SSD_left(i, j));
+                for (int j = 0; j < X; j++) v.pb(i == j ? 0 : (float)SSD_top(i, j));
+            }
+            return vector<char>((const char*)v.data(), (const char*)(v.data() + v.size()));
+        };
+        auto apply = [this](int lo, int hi, const vector<char>& shard) {
+            const float* v = (const float*)shard.data();
+            size_t n = 0;
+            for (int i = lo; i < hi; i++) {
+                if (rotations) {
+                    for (int j = 0; j < i; j++)
+                        for (int s = 0; s < 4; s++)
+                            for (int t = 0; t < 4; t++) sides.set(4 * i + s, 4 * j + t, v[n++]);
+                    continue;
+                }
+                for (int j = 0; j < X; j++, n++)
+                    if (i != j) compat.set(AXIS_H, i, j, v[n]);
+                for (int j = 0; j < X; j++, n++)
+                    if (i != j) compat.set(AXIS_V, i, j, v[n]);
+            }
+        };
+        if (runSharded(workers, X, compute, apply)) return true;
+        cerr << "Scoring workers failed, scoring in this process" << endl;
+        return false;
+    }
+
+    // Groups the edges of every side into classes of strips that differ by
+    // at most classTolerance per value on average. Each edge joins the
+    // first class whose representative is close enough; identical strips
+    // are found by hash first, the rest against the coarse summaries.
+    void buildClasses() {
+        for (int s = 0; s < 4; s++) {
+            edgeClass[s].assign(X, -1);
+            classRep[s].clear();
+            long long tolerance = (long long)(classTolerance * desc.len[s]);
+            unordered_map<uint64_t, int> exact;
+            for (int i = 0; i < X; i++) {
+                uint64_t h = hashBytes(HASH_SEED, desc.get(i, s), desc.len[s]);
+                auto it = exact.find(h);
+                if (it != exact.end() && desc.alike(i, classRep[s][it->second], s, 1) == 0) {
+                    edgeClass[s][i] = it->second;
+                    continue;
+                }
+                for (int c = 0; tolerance > 0 && c < classRep[s].size(); c++) {
+                    int j = classRep[s][c];
+                    if (desc.coarseAlike(i, j, s) > tolerance) continue;
+                    if (desc.alike(i, j, s, tolerance + 1) <= tolerance) {
+                        edgeClass[s][i] = c;
+                        break;
+                    }
+                }
+                if (edgeClass[s][i] == -1) {
+                    edgeClass[s][i] = classRep[s].size();
+                    classRep[s].pb(i);
                 }
+                if (it == exact.end()) exact[h] = edgeClass[s][i];
             }
         }
-        return ssd;
+        map<vector<int>, int> ids;
+        symbol.assign(X, 0);
+        for (int i = 0; i < X; i++) {
+            vector<int> sides;
+            for (int s = 0; s < 4; s++) sides.pb(edgeClass[s][i]);
+            auto it = ids.insert(make_pair(sides, (int)ids.size())).first;
+            symbol[i] = it->second;
+        }
+    }
+
+    // Fills the store from one score per pair of classes
+    void scoreClasses() {
+        int nl = classRep[L].size(), nr = classRep[R].size();
+        int nt = classRep[T].size(), nd = classRep[D].size();
+        vector<float> h((size_t)nl * nr), v((size_t)nt * nd);
+        for (int a = 0; a < nl; a++)
+            for (int b = 0; b < nr; b++) h[(size_t)a * nr + b] = (float)desc.facing(classRep[L][a], L, classRep[R][b], R);
+        for (int a = 0; a < nt; a++)
+            for (int b = 0; b < nd; b++) v[(size_t)a * nd + b] = (float)desc.facing(classRep[T][a], T, classRep[D][b], D);
+        for (int i = 0; i < X; i++)
+            for (int j = 0; j < X; j++) {
+                if (i == j) continue;
+                compat.set(AXIS_H, i, j, h[(size_t)edgeClass[L][i] * nr + edgeClass[R][j]]);
+                compat.set(AXIS_V, i, j, v[(size_t)edgeClass[T][i] * nd + edgeClass[D][j]]);
+            }
+    }
+
+    void insertSidePairs() {
+        for (int i = 0; i < X; i++)
+            for (int j = 0; j < i; j++) scorePair(i, j);
     }
 
     void insertInLeftMatrix() {
         for (int i = 0; i < X; ++i) {
             for (int j = 0; j < X; ++j) {
                 if (i != j) {
-                    double ssd = SSD_left(block[i], block[j]);
-                    adjl[i][j] = ssd;
-                    adjr[j][i] = ssd;
+                    compat.set(AXIS_H, i, j, SSD_left(i, j));
                 }
             }
         }
@@ -225,23 +661,14 @@ public:
         for (int i = 0; i < X; ++i) {
             for (int j = 0; j < X; ++j) {
                 if (i != j) {
-                    double ssd = SSD_top(block[i], block[j]);
-                    adjt[i][j] = ssd;
-                    adjd[j][i] = ssd;
+                    compat.set(AXIS_V, i, j, SSD_top(i, j));
                 }
             }
         }
     }
 
-    // Destructor to clean up allocated memory
+    // The pixels are owned by the arena; only the handles are freed here
     ~Images() {
-        for (int i = 0; i < X; ++i) {
-            for (int j = 0; j < height; ++j) {
-                delete[] block[i].image[j];
-            }
-            delete[] block[i].image;
-            delete[] block[i].bins;
-        }
         delete[] block;
     }
 
@@ -0,0 +1,49 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// Fixed capacity FIFO between pipeline stages. push blocks while the
+// queue is full, pop blocks while it is empty and returns false once the
+// queue has been closed and drained.
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cap(capacity), closed(false) {}
+
+    void push(T v) {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [this]() { return q.size() < cap; });
+        q.push(std::move(v));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& v) {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [this]() { return !q.empty() || closed; });
+        if (q.empty()) return false;
+        v = std::move(q.front());
+        q.pop();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    queue<T> q;
+    size_t cap;
+    bool closed;
+    mutex m;
+    condition_variable notFull, notEmpty;
+};
+
+#endif
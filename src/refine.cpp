@@ -0,0 +1,237 @@
+#include "refine.h"
+#include <thread>
+
+bool Refiner::expired() {
+    return timed && chrono::steady_clock::now() >= deadline;
+}
+
+// Score of the adjacency between two neighbouring slots
+double Refiner::edgeCost(int a, int b) {
+    if (a > b) swap(a, b);
+    if (b == a + 1) return pieces->fit(p[a], R, p[b]);
+    return pieces->fit(p[a], D, p[b]);
+}
+
+// Sum over every adjacency touching one of the given slots, each counted once
+double Refiner::localCost(const int* slots, int n) {
+    double ans = 0;
+    for (int i = 0; i < n; i++) {
+        int s = slots[i];
+        int a = s / N, bb = s % N;
+        int nb[4] = {bb + 1 < N ? s + 1 : -1, a + 1 < N ? s + N : -1,
+                     bb > 0 ? s - 1 : -1, a > 0 ? s - N : -1};
+        for (int j = 0; j < 4; j++) {
+            int t = nb[j];
+            if (t == -1) continue;
+            bool inside = false;
+            for (int k = 0; k < n; k++) if (slots[k] == t) inside = true;
+            if (inside && t < s) continue;
+            ans += edgeCost(s, t);
+        }
+    }
+    return ans;
+}
+
+// Vertical adjacency cost with row a placed directly above row b
+double Refiner::rowSeam(int a, int b) {
+    double ans = 0;
+    for (int c = 0; c < N; c++) ans += pieces->fit(p[a * N + c], D, p[b * N + c]);
+    return ans;
+}
+
+// Horizontal adjacency cost with column a placed directly left of column b
+double Refiner::colSeam(int a, int b) {
+    double ans = 0;
+    for (int r = 0; r < N; r++) ans += pieces->fit(p[r * N + a], R, p[r * N + b]);
+    return ans;
+}
+
+// First-improvement single piece swaps between slots in rows [rowBegin, rowEnd)
+bool Refiner::swapPass(int rowBegin, int rowEnd) {
+    bool improved = false;
+    int end = rowEnd * N;
+    for (int a = rowBegin * N; a < end; a++) {
+        if (a % N == 0 && expired()) break;
+        if (locked[p[a].idx]) continue;
+        for (int b = a + 1; b < end; b++) {
+            if (locked[p[b].idx]) continue;
+            // Interchangeable pieces swap at no gain
+            if (pieces->symbolOf(p[a].idx) == pieces->symbolOf(p[b].idx) && p[a].rot == p[b].rot) continue;
+            int slots[2] = {a, b};
+            double before = localCost(slots, 2);
+            swap(p[a], p[b]);
+            if (localCost(slots, 2) < before - EPS) improved = true;
+            else swap(p[a], p[b]);
+        }
+    }
+    return improved;
+}
+
+// Swap passes over disjoint horizontal bands, one per thread. The last row
+// of every band is frozen, so no thread reads a slot another one writes.
+bool Refiner::parallelSwapPass(int threads, int offset) {
+    int rows = N / threads;
+    vector<int> bounds;
+    for (int i = 0; i < threads; i++) bounds.pb(min(N, offset + i * rows));
+    bounds.pb(N);
+    vector<char> improved(threads, 0);
+    vector<thread> pool;
+    for (int i = 0; i < threads; i++) {
+        int lo = i == 0 ? 0 : bounds[i];
+        int hi = bounds[i + 1] - 1;
+        if (hi - lo < 2) continue;
+        pool.pb(thread([this, &improved, i, lo, hi]() { improved[i] = swapPass(lo, hi); }));
+    }
+    for (int i = 0; i < pool.size(); i++) pool[i].join();
+    return find(improved.begin(), improved.end(), 1) != improved.end();
+}
+
+// Swaps of equal length horizontal or vertical runs of pieces
+bool Refiner::segmentPass() {
+    bool improved = false;
+    for (int len = 2; len <= min(MAX_SEGMENT, N); len++) {
+        for (int dir = 0; dir < 2; dir++) {
+            int step = dir == 0 ? 1 : N;
+            for (int a = 0; a < X; a++) {
+                if (expired()) return improved;
+                if ((dir == 0 ? a % N : a / N) + len > N) continue;
+                for (int b = a + 1; b < X; b++) {
+                    if ((dir == 0 ? b % N : b / N) + len > N) continue;
+                    // Runs must not overlap
+                    if (dir == 0 && b / N == a / N && b - a < len) continue;
+                    if (dir == 1 && b % N == a % N && (b - a) / N < len) continue;
+                    int slots[2 * MAX_SEGMENT];
+                    bool fixed = false;
+                    for (int k = 0; k < len; k++) slots[k] = a + k * step, slots[len + k] = b + k * step;
+                    for (int k = 0; k < 2 * len; k++) if (locked[p[slots[k]].idx]) fixed = true;
+                    if (fixed) continue;
+                    double before = localCost(slots, 2 * len);
+                    for (int k = 0; k < len; k++) swap(p[slots[k]], p[slots[len + k]]);
+                    if (localCost(slots, 2 * len) < before - EPS) improved = true;
+                    else for (int k = 0; k < len; k++) swap(p[slots[k]], p[slots[len + k]]);
+                }
+            }
+        }
+    }
+    return improved;
+}
+
+// Rows [0, r) hold fixed[r] locked pieces; a move shifts every row
+// between the old and the new position, so none of them may hold one
+static bool lockedBetween(const vector<int> &fixed, int r, int q) {
+    int lo = min(r, q), hi = max(r + 1, q);
+    return fixed[hi] > fixed[lo];
+}
+
+// Moves a whole row to another position; only the three seams it
+// touches change, so each candidate costs O(N).
+bool Refiner::rowMovePass() {
+    double best = -EPS;
+    int br = -1, bq = -1;
+    vector<int> fixed(N + 1, 0);
+    for (int r = 0; r < N; r++) {
+        fixed[r + 1] = fixed[r];
+        for (int c = 0; c < N; c++) fixed[r + 1] += locked[p[r * N + c].idx];
+    }
+    for (int r = 0; r < N; r++) {
+        double removed = 0;
+        if (r > 0) removed -= rowSeam(r - 1, r);
+        if (r + 1 < N) removed -= rowSeam(r, r + 1);
+        if (r > 0 && r + 1 < N) removed += rowSeam(r - 1, r + 1);
+        // Insert r between rows q-1 and q of the remaining order
+        for (int q = 0; q <= N; q++) {
+            if (q == r || q == r + 1 || lockedBetween(fixed, r, q)) continue;
+            double delta = removed;
+            if (q > 0) delta += rowSeam(q - 1, r);
+            if (q < N) delta += rowSeam(r, q);
+            if (q > 0 && q < N) delta -= rowSeam(q - 1, q);
+            if (delta < best) best = delta, br = r, bq = q;
+        }
+    }
+    if (br == -1) return false;
+    vector<int> order;
+    for (int q = 0; q <= N; q++) {
+        if (q == bq) order.pb(br);
+        if (q < N && q != br) order.pb(q);
+    }
+    vector<Block> old = p;
+    for (int i = 0; i < N; i++)
+        for (int c = 0; c < N; c++) p[i * N + c] = old[order[i] * N + c];
+    return true;
+}
+
+bool Refiner::colMovePass() {
+    double best = -EPS;
+    int bc = -1, bq = -1;
+    vector<int> fixed(N + 1, 0);
+    for (int c = 0; c < N; c++) {
+        fixed[c + 1] = fixed[c];
+        for (int r = 0; r < N; r++) fixed[c + 1] += locked[p[r * N + c].idx];
+    }
+    for (int c = 0; c < N; c++) {
+        double removed = 0;
+        if (c > 0) removed -= colSeam(c - 1, c);
+        if (c + 1 < N) removed -= colSeam(c, c + 1);
+        if (c > 0 && c + 1 < N) removed += colSeam(c - 1, c + 1);
+        for (int q = 0; q <= N; q++) {
+            if (q == c || q == c + 1 || lockedBetween(fixed, c, q)) continue;
+            double delta = removed;
+            if (q > 0) delta += colSeam(q - 1, c);
+            if (q < N) delta += colSeam(c, q);
+            if (q > 0 && q < N) delta -= colSeam(q - 1, q);
+            if (delta < best) best = delta, bc = c, bq = q;
+        }
+    }
+    if (bc == -1) return false;
+    vector<int> order;
+    for (int q = 0; q <= N; q++) {
+        if (q == bq) order.pb(bc);
+        if (q < N && q != bc) order.pb(q);
+    }
+    vector<Block> old = p;
+    for (int r = 0; r < N; r++)
+        for (int i = 0; i < N; i++) p[r * N + i] = old[r * N + order[i]];
+    return true;
+}
+
+// Turns single pieces in place
+bool Refiner::turnPass() {
+    bool improved = false;
+    for (int a = 0; a < X; a++) {
+        if (expired()) break;
+        if (locked[p[a].idx]) continue;
+        double best = localCost(&a, 1);
+        int base = p[a].rot, rot = base;
+        for (int r = 1; r < 4; r++) {
+            p[a].rot = (base + r) & 3;
+            double c = localCost(&a, 1);
+            if (c < best - EPS) best = c, rot = p[a].rot, improved = true;
+        }
+        p[a].rot = rot;
+    }
+    return improved;
+}
+
+vector<Block> Refiner::run(const vector<Block> &c, double seconds) {
+    deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+    p = c;
+
+    int threads = max(1u, thread::hardware_concurrency());
+    threads = min(threads, N / MIN_BAND_ROWS);
+    // The bands depend on the thread count
+    if (!timed) threads = 1;
+    int round = 0;
+    bool improved = true;
+    while (improved && !expired()) {
+        improved = false;
+        if (threads > 1)
+            improved |= parallelSwapPass(threads, (round++ % 2) * (N / threads / 2));
+        improved |= swapPass(0, N);
+        improved |= segmentPass();
+        improved |= rowMovePass();
+        improved |= colMovePass();
+        if (pieces->rotations) improved |= turnPass();
+        if (improved && progress) progress(p);
+    }
+    return p;
+}
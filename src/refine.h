@@ -0,0 +1,54 @@
+#ifndef REFINE_H
+#define REFINE_H
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <functional>
+
+#include "image.hpp"
+
+using namespace std;
+
+#define MAX_SEGMENT 3
+#define MIN_BAND_ROWS 4
+#define EPS 1e-9
+
+// Local search over a finished arrangement. Every move is scored by the
+// change in the adjacencies it touches only, so a swap costs a constant
+// number of lookups in the compatibility store regardless of X.
+class Refiner
+{
+	int N, X;
+	Images* pieces;
+	vector<Block> p;  // piece per slot
+	vector<char> locked;  // pieces that no move may shift
+	chrono::steady_clock::time_point deadline;
+
+	bool expired();
+	double edgeCost(int a, int b);
+	double localCost(const int* slots, int n);
+	double rowSeam(int a, int b);
+	double colSeam(int a, int b);
+	bool swapPass(int rowBegin, int rowEnd);
+	bool parallelSwapPass(int threads, int offset);
+	bool segmentPass();
+	bool rowMovePass();
+	bool colMovePass();
+	bool turnPass();
+
+public:
+	// An untimed refiner runs until no move helps, on one thread, so its
+	// result does not depend on the machine
+	bool timed;
+	// Called with the arrangement after every round that improved it
+	function<void(const vector<Block> &)> progress;
+
+	Refiner(int n, Images * image) : N(n), X(n*n), pieces(image), locked(n*n, 0), timed(true) {}
+	void lock(const vector<char> &pieceLocked) { locked = pieceLocked; }
+	vector<Block> run(const vector<Block> &c, double seconds);
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#include <stdint.h>
+
+// Counter-based random stream. The stream is named by the run seed and the
+// task it belongs to (e.g. generation and child), and its n-th draw is a
+// hash of that name and n. Draws therefore never depend on which thread
+// ran a task, or on the order tasks ran in.
+class Stream {
+public:
+    Stream(uint64_t seed = 0, uint64_t a = 0, uint64_t b = 0) : counter(0) {
+        key = mix(mix(mix(seed) + a) + b);
+    }
+
+    uint64_t next() { return mix(key + 0x9e3779b97f4a7c15ULL * ++counter); }
+
+    // Uniform in [0, n) for n > 0
+    int below(int n) { return (int)(((next() >> 32) * (uint64_t)n) >> 32); }
+
+    // splitmix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z += 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t key, counter;
+};
+
+#endif
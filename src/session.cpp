@@ -0,0 +1,206 @@
+#include "session.h"
+#include <cmath>
+
+bool SolveSession::mutual(int p, int d, int q) {
+    return q != -1 && best(p, d) == q && best(q, 3 - d) == p;
+}
+
+// Inserts q into the sorted candidate list of side d of p if it beats an
+// entry; returns true if it became the best match
+bool SolveSession::offer(int p, int d, int q, double s) {
+    int* c = &cand[((size_t)p * 4 + d) * CANDIDATES];
+    double* v = &candScore[((size_t)p * 4 + d) * CANDIDATES];
+    int k = CANDIDATES - 1;
+    if (c[k] != -1 && v[k] <= s) return false;
+    while (k > 0 && (c[k - 1] == -1 || v[k - 1] > s)) {
+        c[k] = c[k - 1];
+        v[k] = v[k - 1];
+        k--;
+    }
+    c[k] = q;
+    v[k] = s;
+    return k == 0;
+}
+
+// Moves p out of its segment into a segment of its own
+void SolveSession::detach(int p) {
+    int s = seg[p];
+    if (members[s].size() == 1) return;
+    cells[s].erase(local[p]);
+    members[s].erase(find(members[s].begin(), members[s].end(), p));
+    seg[p] = members.size();
+    local[p] = pii(0, 0);
+    members.pb(vector<int>(1, p));
+    cells.pb(map<pii, int>());
+    cells.back()[pii(0, 0)] = p;
+}
+
+// Removing a piece can cut a segment in two; pieces no longer connected
+// to the first member through placed neighbours move to new segments so
+// their relative offsets are free again.
+void SolveSession::split(int s) {
+    if (members[s].empty()) return;
+    map<pii, int> rest = cells[s];
+    bool first = true;
+    while (!rest.empty()) {
+        vector<int> part;
+        queue<pii> Q;
+        Q.push(rest.begin()->first);
+        part.pb(rest.begin()->second);
+        rest.erase(rest.begin());
+        while (!Q.empty()) {
+            pii c = Q.front();
+            Q.pop();
+            for (int e = 0; e < 4; e++) {
+                map<pii, int>::iterator it = rest.find(pii(c.first + sideRow[e], c.second + sideCol[e]));
+                if (it == rest.end()) continue;
+                Q.push(it->first);
+                part.pb(it->second);
+                rest.erase(it);
+            }
+        }
+        if (first) {
+            first = false;
+            if (part.size() == members[s].size()) return;
+            members[s] = part;
+            cells[s].clear();
+            for (int i = 0; i < part.size(); i++) cells[s][local[part[i]]] = part[i];
+            continue;
+        }
+        int id = members.size();
+        members.pb(part);
+        cells.pb(map<pii, int>());
+        for (int i = 0; i < part.size(); i++) {
+            seg[part[i]] = id;
+            cells[id][local[part[i]]] = part[i];
+        }
+    }
+}
+
+// Adds the single piece among p and q to the segment of the other, with q
+// on side d of p, provided every new contact is between mutual best
+// buddies and the segment still fits the frame.
+bool SolveSession::merge(int p, int d, int q) {
+    int a = seg[p], b = seg[q];
+    if (a == b) return false;
+    // As in Hierarchical::buildSegments segments only grow piece by piece;
+    // joining two of them on a single link is left to the assembly, which
+    // judges them by their whole boundary
+    if (members[a].size() > 1 && members[b].size() > 1) return false;
+    pii shift(local[p].first + sideRow[d] - local[q].first, local[p].second + sideCol[d] - local[q].second);
+    if (members[b].size() > members[a].size()) {
+        swap(a, b);
+        shift = pii(-shift.first, -shift.second);
+    }
+
+    int minr = INF, maxr = -INF, minc = INF, maxc = -INF;
+    for (map<pii, int>::iterator it = cells[a].begin(); it != cells[a].end(); it++) {
+        minr = min(minr, it->first.first), maxr = max(maxr, it->first.first);
+        minc = min(minc, it->first.second), maxc = max(maxc, it->first.second);
+    }
+    for (int i = 0; i < members[b].size(); i++) {
+        int m = members[b][i];
+        pii c(local[m].first + shift.first, local[m].second + shift.second);
+        if (cells[a].count(c)) return false;
+        for (int e = 0; e < 4; e++) {
+            map<pii, int>::iterator it = cells[a].find(pii(c.first + sideRow[e], c.second + sideCol[e]));
+            if (it != cells[a].end() && !mutual(m, e, it->second)) return false;
+        }
+        minr = min(minr, c.first), maxr = max(maxr, c.first);
+        minc = min(minc, c.second), maxc = max(maxc, c.second);
+    }
+    if (N > 0 && (maxr - minr >= N || maxc - minc >= N)) return false;
+
+    for (int i = 0; i < members[b].size(); i++) {
+        int m = members[b][i];
+        local[m] = pii(local[m].first + shift.first, local[m].second + shift.second);
+        seg[m] = a;
+        cells[a][local[m]] = m;
+        members[a].pb(m);
+    }
+    members[b].clear();
+    cells[b].clear();
+    return true;
+}
+
+void SolveSession::addPiece(const cv::Mat &img) {
+    int n = pieces->addPiece(img);
+    cand.resize((size_t)(n + 1) * 4 * CANDIDATES, -1);
+    candScore.resize((size_t)(n + 1) * 4 * CANDIDATES, 0);
+    seg.pb(members.size());
+    local.pb(pii(0, 0));
+    members.pb(vector<int>(1, n));
+    cells.pb(map<pii, int>());
+    cells.back()[pii(0, 0)] = n;
+
+    // The new piece can only displace entries of the existing lists
+    vector<int> changed(1, n);
+    for (int i = 0; i < n; i++) {
+        bool beaten = false;
+        for (int d = 0; d < 4; d++) {
+            if (offer(i, d, n, pieces->adj(i, d, n))) beaten = true;
+            offer(n, d, i, pieces->adj(n, d, i));
+        }
+        if (beaten) changed.pb(i);
+    }
+
+    // Pieces whose adjacencies stopped being mutual leave their segment,
+    // and what remains of it is split into its connected parts
+    vector<int> broken;
+    for (int k = 1; k < changed.size(); k++) {
+        int p = changed[k];
+        for (int e = 0; e < 4; e++) {
+            map<pii, int>::iterator it = cells[seg[p]].find(pii(local[p].first + sideRow[e], local[p].second + sideCol[e]));
+            if (it != cells[seg[p]].end() && !mutual(p, e, it->second)) {
+                broken.pb(seg[p]);
+                detach(p);
+                break;
+            }
+        }
+    }
+    for (int k = 0; k < broken.size(); k++) split(broken[k]);
+
+    for (int k = 0; k < changed.size(); k++) {
+        int p = changed[k];
+        for (int d = 0; d < 4; d++)
+            if (mutual(p, d, best(p, d))) pending.insert(pii(p, d));
+    }
+
+    // A merge can unblock earlier ones, so retry until nothing changes;
+    // pairs stay pending while they are mutual but blocked, and are
+    // dropped once joined at the right offset or no longer mutual
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (set<pii>::iterator it = pending.begin(); it != pending.end();) {
+            int p = it->first, d = it->second, q = best(p, d);
+            bool done = !mutual(p, d, q);
+            if (!done && seg[p] == seg[q])
+                done = local[q] == pii(local[p].first + sideRow[d], local[p].second + sideCol[d]);
+            else if (!done && merge(p, d, q))
+                done = progress = true;
+            if (done) pending.erase(it++);
+            else it++;
+        }
+    }
+}
+
+int SolveSession::largestSegment() {
+    int ans = 0;
+    for (int s = 0; s < members.size(); s++) ans = max(ans, (int)members[s].size());
+    return ans;
+}
+
+vector<Block> SolveSession::finish() {
+    int X = pieces->X;
+    int n = (int)round(sqrt((double)X));
+    if (n * n != X) {
+        cerr << X << " pieces do not form a square grid" << endl;
+        return vector<Block>();
+    }
+    pieces->N = n;
+    Hierarchical hier(n, pieces);
+    vector<Block> ans = hier.solveFrom(seg, local, members, cand);
+    locked = hier.lockedPieces();
+    return ans;
+}
@@ -0,0 +1,53 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+
+#include "image.hpp"
+#include "hierarchical.h"
+
+using namespace std;
+
+// Solves a puzzle while its pieces are still arriving. Every added piece
+// extends the compatibility data by one row and column per axis, enters
+// the candidate lists of the sides it fits better than their current
+// entries, and joins the best-buddy segment it agrees with, so
+// the final solve only has to assemble segments that already exist.
+class SolveSession
+{
+	int N;                        // expected grid size, 0 if unknown
+	Images* pieces;
+	vector<int> cand;             // CANDIDATES best matches per piece and side
+	vector<double> candScore;
+	vector<int> seg;              // segment of each piece
+	vector<pii> local;            // offset of each piece inside its segment
+	vector<vector<int> > members;
+	vector<map<pii, int> > cells;
+	set<pii> pending;             // mutual (piece, side) pairs not merged yet
+	vector<char> locked;          // pieces of the segments finish() placed whole
+
+	int best(int p, int d) { return cand[((size_t)p * 4 + d) * CANDIDATES]; }
+	bool mutual(int p, int d, int q);
+	bool offer(int p, int d, int q, double s);
+	void detach(int p);
+	void split(int s);
+	bool merge(int p, int d, int q);
+
+public:
+	SolveSession(Images * image, int n = 0) : N(n), pieces(image) {}
+	void addPiece(const cv::Mat &img);
+	int size() { return pieces->X; }
+	int largestSegment();
+	// Pieces of the segments finish() placed whole; the others were
+	// scattered by its greedy fill. Empty before finish().
+	vector<char> lockedPieces() { return locked; }
+	vector<Block> finish();
+};
+
+#endif
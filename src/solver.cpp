@@ -4,6 +4,16 @@
 #include "image.hpp"
 #include "MST_solver.h"
 #include "GA_solver.h"
+#include "refine.h"
+#include "hierarchical.h"
+#include "session.h"
+#include "exact.h"
+#include "checkpoint.hpp"
+#include <thread>
+#include <sys/stat.h>
+#include <chrono>
+#include <random>
+#include <memory>
 #include <opencv2/imgcodecs.hpp> // For image I/O functions
 #include <opencv2/core.hpp> // For Mat
 #include <opencv2/imgproc.hpp> // For image processing functions
@@ -11,6 +21,9 @@
 using namespace std;
 
 #define TIME_LIMIT 15.0
+#define POLL_MS 10
+#define ARRIVAL_TIMEOUT 60.0
+#define ANN_RECALL_SAMPLES 256
 
 int N, X;
 Images pieces;
@@ -21,21 +34,35 @@ void saveResult(const vector<Block>& ans, int height, int width, const string& o
         int startRow = (i / N) * height;
         int startCol = (i % N) * width;
         for (int j = 0; j < height; j++) {
-            for (int k = 0; k < width; k++) {
-                cv::Vec3b& pixel = finalImage.at<cv::Vec3b>(startRow + j, startCol + k);
-                for (int h = 0; h < 3; h++) {
-                    pixel[h] = static_cast<unsigned char>(ans[i].image[j][k].val[h]);
-                }
+            unsigned char* row = finalImage.ptr<unsigned char>(startRow + j) + startCol * 3;
+            if (ans[i].rot == 0) {
+                memcpy(row, ans[i].at(j, 0), (size_t)width * 3);
+                continue;
             }
+            for (int k = 0; k < width; k++) memcpy(row + k * 3, ans[i].turnedAt(j, k), 3);
         }
     }
     cv::imwrite(output, finalImage);
 }
 
-double calculateNCS(const vector<Block>& solved, int N) {
+// NCS of the arrangement turned back by g quarter turns counter-clockwise;
+// a piece only counts as correct if its own net turn is g as well
+double turnedNCS(const vector<Block>& placed, int N, int g) {
     int correctRelations = 0;
     int totalRelations = 0;
 
+    vector<Block> solved(placed.size());
+    for (int i = 0; i < placed.size(); ++i) {
+        int r = i / N, c = i % N;
+        for (int k = 0; k < g; k++) {
+            int t = r;
+            r = N - 1 - c;
+            c = t;
+        }
+        solved[r * N + c] = placed[i];
+        if (((placed[i].original_rot + placed[i].rot) & 3) != g) solved[r * N + c].idx = -1;
+    }
+
     for (int i = 0; i < solved.size(); ++i) {
         int originalX = solved[i].original_idx % N;
         int originalY = solved[i].original_idx / N;
@@ -43,7 +70,7 @@ double calculateNCS(const vector<Block>& solved, int N) {
         // Right neighbor check
         if (originalX < N - 1) {
             int rightNeighborOriginalIdx = solved[i].original_idx + 1;
-            if (i % N < N - 1 && solved[i + 1].original_idx == rightNeighborOriginalIdx) {
+            if (i % N < N - 1 && solved[i + 1].original_idx == rightNeighborOriginalIdx && solved[i].idx != -1 && solved[i + 1].idx != -1) {
                 correctRelations++;
             } else if(i % N < N - 1) {
             }
@@ -53,7 +80,7 @@ double calculateNCS(const vector<Block>& solved, int N) {
         // Bottom neighbor check
         if (originalY < N - 1) {
             int bottomNeighborOriginalIdx = solved[i].original_idx + N;
-            if (i + N < solved.size() && solved[i + N].original_idx == bottomNeighborOriginalIdx) {
+            if (i + N < solved.size() && solved[i + N].original_idx == bottomNeighborOriginalIdx && solved[i].idx != -1 && solved[i + N].idx != -1) {
                 correctRelations++;
             } else if(i + N < solved.size()) {
             }
@@ -65,38 +92,228 @@ double calculateNCS(const vector<Block>& solved, int N) {
     return ncs;
 }
 
+// Turned pieces can only be solved up to a turn of the whole picture
+double calculateNCS(const vector<Block>& solved, int N) {
+    double best = 0;
+    for (int g = 0; g < pieces.turns(); g++) best = max(best, turnedNCS(solved, N, g));
+    return best;
+}
+
 
 
+// Feeds the pieces of an n x n puzzle to a SolveSession as they appear in
+// dir, in name order, and returns the session's arrangement
+vector<Block> solveIncremental(int n, const string& dir, vector<char>& locked) {
+    SolveSession session(&pieces, n);
+    chrono::steady_clock::time_point last = chrono::steady_clock::now();
+    for (int i = 0; i < n * n;) {
+        string filename = dir + to_string(i + 1) + ".jpg";
+        struct stat st;
+        cv::Mat img;
+        if (stat(filename.c_str(), &st) == 0) img = cv::imread(filename);
+        // Not there yet, or still being written
+        if (img.empty() || (i > 0 && (img.rows != pieces.height || img.cols != pieces.width))) {
+            if (chrono::duration<double>(chrono::steady_clock::now() - last).count() > ARRIVAL_TIMEOUT) {
+                cerr << "Timed out waiting for " << filename << endl;
+                return vector<Block>();
+            }
+            this_thread::sleep_for(chrono::milliseconds(POLL_MS));
+            continue;
+        }
+        if (i == 0) pieces.beginIncremental(img.rows, img.cols);
+        session.addPiece(img);
+        last = chrono::steady_clock::now();
+        i++;
+    }
+    pieces.loadMetadata(dir);
+    vector<Block> ans = session.finish();
+    locked = session.lockedPieces();
+    return ans;
+}
+
 int main(int argc, char* argv[]) {
     int given_N = -1;
     string dir = "./generated_pieces";
-    if (argc == 3) {
+    InitMode init = INIT_MIXED;
+    bool refine = true;
+    bool incremental = false;
+    int islands = 1;
+    bool seeded = false;
+    bool checkpointing = false, resume = false;
+    bool recall = false;
+    uint64_t seed = random_device()();
+    string engine = "auto";
+    if (argc >= 3) {
         given_N = atoi(argv[1]);
         dir = argv[2];
         // If dir doesn't end with a slash, add one
         if (dir.back() != '/') {
             dir += '/';
         }
+        for (int i = 3; i < argc; i++) {
+            string opt = argv[i];
+            if (opt == "--init=random") init = INIT_RANDOM;
+            else if (opt == "--init=mixed") init = INIT_MIXED;
+            else if (opt == "--cache") pieces.cache = true;
+            else if (opt == "--pipeline") pieces.pipeline = true;
+            else if (opt == "--incremental") incremental = true;
+            else if (opt == "--rotations") pieces.rotations = true;
+            else if (opt == "--sparse") pieces.sparse = true;
+            else if (opt == "--ann") pieces.sparse = pieces.ann = true;
+            else if (opt == "--ann-recall") pieces.sparse = pieces.ann = recall = true;
+            else if (opt == "--no-refine") refine = false;
+            else if (opt == "--classes") pieces.classes = true;
+            else if (opt.rfind("--classes=", 0) == 0 && atof(opt.c_str() + 10) >= 0)
+                pieces.classes = true, pieces.classTolerance = atof(opt.c_str() + 10);
+            else if (opt == "--checkpoint") checkpointing = true;
+            else if (opt == "--resume") resume = checkpointing = true;
+            else if (opt.rfind("--workers=", 0) == 0 && atoi(opt.c_str() + 10) >= 1) pieces.workers = atoi(opt.c_str() + 10);
+            else if (opt.rfind("--seed=", 0) == 0 && opt.size() > 7) seed = strtoull(opt.c_str() + 7, NULL, 10), seeded = true;
+            else if (opt.rfind("--islands=", 0) == 0 && atoi(opt.c_str() + 10) >= 1) islands = atoi(opt.c_str() + 10);
+            else if (opt == "--solver=auto" || opt == "--solver=ga" || opt == "--solver=mst" ||
+                     opt == "--solver=hierarchical" || opt == "--solver=exact") engine = opt.substr(9);
+            else if (opt.rfind("--precision=", 0) == 0 && parsePrecision(opt.substr(12), pieces.precision)) {}
+            else {
+                cerr << "Unknown option: " << opt << endl;
+                return 1;
+            }
+        }
     } else if (argc != 1) {
-        cout << "Usage: " << argv[0] << " [N]" << endl;
+        cout << "Usage: " << argv[0] << " [N dir [--init=random|mixed] [--precision=float|u16] [--cache] [--pipeline] [--incremental] [--rotations] [--sparse] [--ann] [--ann-recall] [--workers=N] [--islands=N] [--seed=S] [--classes[=T]] [--checkpoint] [--resume] [--no-refine] [--solver=auto|ga|mst|hierarchical|exact]]" << endl;
+        return 1;
+    }
+
+    // Turned pieces are scored per pair of sides, which only the GA, the
+    // MST solver and the refiner understand
+    if (pieces.rotations && (pieces.cache || incremental || engine == "hierarchical")) {
+        cerr << "--rotations does not work with --cache, --incremental or --solver=hierarchical" << endl;
+        return 1;
+    }
+    // Sparse puzzles keep no scores to cache or to grow
+    if (pieces.sparse && (pieces.cache || incremental || pieces.rotations)) {
+        cerr << "--sparse and --ann do not work with --cache, --incremental or --rotations" << endl;
         return 1;
     }
 
-    pieces.initializeAll(given_N, dir);
+    // Pieces that arrive one by one are scored as they come, into a store
+    // that grows with them
+    if (incremental && (pieces.workers > 1 || pieces.cache || pieces.pipeline)) {
+        cerr << "--workers, --cache and --pipeline do not work with --incremental" << endl;
+        return 1;
+    }
+
+    // Classes are built from the whole set of upright pieces, and only the
+    // store is scored through them
+    if (pieces.classes && (incremental || pieces.rotations || pieces.sparse)) {
+        cerr << "--classes does not work with --incremental, --rotations, --sparse or --ann" << endl;
+        return 1;
+    }
+    // Checkpoints hold one GA population or one arrangement
+    if (checkpointing && (incremental || islands > 1)) {
+        cerr << "--checkpoint and --resume do not work with --incremental or --islands" << endl;
+        return 1;
+    }
+    // Checkpoints refer to the cached scores, so a resumed run maps them
+    // instead of scoring again
+    if (checkpointing && !pieces.sparse && !pieces.rotations) pieces.cache = true;
+
+    vector<Block> ans;
+    vector<char> locked;
+    if (incremental) {
+        if (given_N <= 0) {
+            cerr << "--incremental needs N" << endl;
+            return 1;
+        }
+        ans = solveIncremental(given_N, dir, locked);
+        if (ans.empty()) return 1;
+    } else {
+        pieces.initializeAll(given_N, dir);
+    }
     N = pieces.N;
     X = N * N;
+    if (pieces.classes) {
+        int edges = 0;
+        for (int s = 0; s < 4; s++) edges += pieces.classRep[s].size();
+        int symbols = *max_element(pieces.symbol.begin(), pieces.symbol.end()) + 1;
+        cout << "Edge classes: " << edges << " of " << 4 * X << " edges, " << symbols << " distinct pieces" << endl;
+    }
+    if (recall)
+        cout << "ANN recall@" << CANDIDATES << ": " << pieces.indexRecall(ANN_RECALL_SAMPLES, CANDIDATES) << endl;
 
     vector<Block> scrambled = pieces.getScrambledImage();
     saveResult(scrambled, pieces.height, pieces.width, dir + "scrambled_image.jpg");
 
-    vector<Block> ans;
-    // if (N > 15) {
-    //     MST mst(N, &pieces);
-    //     ans = mst.get_mst(pieces.height, pieces.width);
-    // } else {
-        GA ga(N, &pieces);
+    string checkpointPath = dir + "solver.checkpoint";
+    uint64_t key = checkpointing ? pieces.cacheKey() : 0;
+    Checkpoint saved;
+    bool resumed = resume && loadCheckpoint(checkpointPath, pieces, key, saved);
+    if (resume && !resumed) cerr << "No checkpoint for these pieces in " << checkpointPath << ", starting over" << endl;
+    unique_ptr<CheckpointWriter> writer(checkpointing ? new CheckpointWriter(checkpointPath) : nullptr);
+    // Snapshots are moved through to the writer, never copied again
+    auto submit = [&](Checkpoint &&c) {
+        c.key = key;
+        c.rotations = pieces.rotations;
+        writer->submit(move(c));
+    };
+    auto submitLayout = [&](const vector<Block> &layout) {
+        Checkpoint c;
+        c.add(layout);
+        submit(move(c));
+    };
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (engine == "auto") {
+        if (X <= EXACT_AUTO_PIECES) engine = "exact";
+        else engine = X >= HIERARCHICAL_MIN_PIECES && !pieces.rotations ? "hierarchical" : "ga";
+    }
+    if (engine == "exact" && X > EXACT_MAX_PIECES) {
+        cerr << "The exact solver takes at most " << EXACT_MAX_PIECES << " pieces" << endl;
+        return 1;
+    }
+    if (resumed && saved.stage == CHECKPOINT_GA) engine = "ga";
+    if (incremental) {
+        // The session has assembled the pieces as they arrived
+    } else if (resumed && saved.stage == CHECKPOINT_LAYOUT) {
+        // The engine had finished; only refining is left
+        ans = saved.layout(0, pieces);
+    } else if (engine == "hierarchical") {
+        Hierarchical hier(N, &pieces);
+        ans = hier.solve();
+        locked = hier.lockedPieces();
+    } else if (engine == "exact") {
+        // The GA takes milliseconds at this size, and the search starts
+        // from its layout, so running out of budget costs nothing over it
+        GA ga(N, &pieces, init);
+        ga.seed = seed;
+        ga.timed = !seeded;
+        Exact exact(N, &pieces);
+        exact.timed = !seeded;
+        ans = exact.solve(ga.runAlgo(pieces.height, pieces.width));
+        // A proven optimum leaves the refiner nothing to do
+        if (exact.optimal()) refine = false;
+        else cerr << "The exact solver ran out of budget; its layout is the best found, not proven optimal" << endl;
+    } else if (engine == "mst") {
+        MST mst(N, &pieces);
+        ans = mst.get_mst(pieces.height, pieces.width);
+    } else if (islands > 1) {
+        ans = GA::runIslands(N, &pieces, init, islands, pieces.height, pieces.width, seed, !seeded);
+    } else {
+        GA ga(N, &pieces, init);
+        ga.seed = seed;
+        ga.timed = !seeded;
+        if (resumed) ga.resumeFrom(saved);
+        if (writer) ga.checkpoint = submit;
         ans = ga.runAlgo(pieces.height, pieces.width);
-    // }
+    }
+    if (writer) submitLayout(ans);
+    if (refine) {
+        double spent = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        Refiner refiner(N, &pieces);
+        refiner.timed = !seeded;
+        if (!locked.empty()) refiner.lock(locked);
+        if (writer) refiner.progress = submitLayout;
+        ans = refiner.run(ans, max(0.0, TIME_LIMIT - spent));
+    }
     saveResult(ans, pieces.height, pieces.width, dir + "solved_image.jpg");
 
     cout << "NCS: " << calculateNCS(ans, N) << endl;
@@ -24,7 +24,7 @@ def file_specific_seed(file_path, global_seed):
     file_seed = int(hash_value, 16) % (2**31)  # Use a 32-bit integer for the seed
     return file_seed
 
-def process_images(queue, directory, piece_size, csv_file, seed, index, lock):
+def process_images(queue, directory, piece_size, csv_file, seed, index, lock, ann=False, min_recall=0.0):
     generated_dir = f"generated/{index}/"
     os.makedirs(generated_dir, exist_ok=True)
 
@@ -62,16 +62,34 @@ def process_images(queue, directory, piece_size, csv_file, seed, index, lock):
             subprocess.run(generate_cmd, stdout=subprocess.DEVNULL, stderr=subprocess.STDOUT)
 
             solver_cmd = ["./solver", str(n), generated_dir]
+            if ann:
+                solver_cmd.append("--ann-recall")
             process = subprocess.run(solver_cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
             ncs_value = process.stdout.strip().split("NCS: ")[-1]
             end_time = time.time()
             execution_time = end_time - start_time
 
+            # The solver checks its edge index against the exact search before solving
+            recall = None
+            if ann:
+                for line in process.stdout.splitlines():
+                    if line.startswith("ANN recall@"):
+                        recall = float(line.split(": ")[-1])
+
             with lock:
                 logging.info(f"{relative_path} was solved in {execution_time:.2f} seconds with accuracy of {float(ncs_value)*100:.2f}%.")
+                if ann and recall is None:
+                    logging.error(f"{relative_path}: the solver reported no ANN recall")
+                elif ann and recall < min_recall:
+                    logging.error(f"{relative_path}: ANN recall {recall:.3f} is below {min_recall:.3f}")
+                elif ann:
+                    logging.info(f"{relative_path}: ANN recall {recall:.3f}")
                 with open(csv_file, "a", newline='') as file_handle:
                     writer = csv.writer(file_handle)
-                    writer.writerow([relative_path, ncs_value, end_time - start_time])
+                    row = [relative_path, ncs_value, end_time - start_time]
+                    if ann:
+                        row.append(recall)
+                    writer.writerow(row)
 
             os.remove(temp_img_path)
         except Exception as e:
@@ -79,6 +97,35 @@ def process_images(queue, directory, piece_size, csv_file, seed, index, lock):
         except KeyboardInterrupt:
             break;
 
+def check_single_piece(directory, seed):
+    """
+    Solve one image as a 1x1 puzzle with the default engine choice, which
+    takes a path of its own through the solvers. Returns False on a crash.
+    """
+    single_dir = "generated/single/"
+    os.makedirs(single_dir, exist_ok=True)
+    for root, _, files in os.walk(directory):
+        for name in sorted(files):
+            try:
+                img = Image.open(os.path.join(root, name)).convert('RGB')
+            except IOError:
+                continue
+            img = img.resize((224, 224), resample=Image.Resampling.LANCZOS)
+            img_path = os.path.join(single_dir, "temp_single.jpg")
+            img.save(img_path, format="JPEG")
+            subprocess.run(["./generate_pieces", img_path, "224", single_dir, str(seed)], stdout=subprocess.DEVNULL, stderr=subprocess.STDOUT)
+            process = subprocess.run(["./solver", "1", single_dir, "--solver=auto"], stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+            os.remove(img_path)
+            if process.returncode != 0 or "NCS: " not in process.stdout:
+                lines = process.stderr.strip().splitlines()
+                reason = next((line for line in lines if "ERROR" in line), lines[-1] if lines else "")
+                logging.error(f"1x1 puzzle failed with exit code {process.returncode}: {reason}")
+                return False
+            logging.info("1x1 puzzle solved.")
+            return True
+    logging.warning("No image found for the 1x1 check.")
+    return True
+
 # Function to get the names of already processed files
 def get_processed_files(csv_file):
     if not os.path.exists(csv_file):
@@ -109,9 +156,15 @@ if __name__ == "__main__":
     parser.add_argument('--csv', type=str, default='results.csv', help='CSV file to store results')
     parser.add_argument('--seed', type=int, default=42, help='Seed for random directory walk')
     parser.add_argument('--threads', type=int, default=cpu_count(), help='Number of concurrent threads')
+    parser.add_argument('--ann', action='store_true', help='Solve with the edge index and check its recall')
+    parser.add_argument('--min_recall', type=float, default=0.95, help='Lowest acceptable ANN recall')
+    parser.add_argument('--skip_single', action='store_true', help='Skip the 1x1 puzzle check')
 
     args = parser.parse_args()
 
+    if not args.skip_single:
+        check_single_piece(args.directory, args.seed)
+
     queue = Queue()
     lock = Lock()
     processes = []
@@ -123,7 +176,7 @@ if __name__ == "__main__":
 
         # Start consumer processes
         for index in range(args.threads):
-            p = Process(target=process_images, args=(queue, args.directory, args.piece_size, args.csv, args.seed, index, lock))
+            p = Process(target=process_images, args=(queue, args.directory, args.piece_size, args.csv, args.seed, index, lock, args.ann, args.min_recall))
             processes.append(p)
             p.start()
 